@@ -0,0 +1,418 @@
+#include "cast.h"
+#include "events.h"
+#include "input.h"
+#include "output.h"
+#include "timing.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef CAST_DEFLATE
+#include <zlib.h>
+#endif
+
+// bytes in the queue, a power of two
+#define CAST_QUEUE_SIZE (1 << 22)
+// output is queued in pieces of at most this many bytes
+#define CAST_MAX_CHUNK (1 << 16)
+#define CAST_WRITE_INTERVAL (10 * NANOSECONDS_PER_MILLISECOND)
+#define CAST_FILE_BUFFER_SIZE (1 << 20)
+// a JSON escaped byte takes at most 6 characters
+#define CAST_LINE_SIZE (CAST_MAX_CHUNK * 6 + 64)
+#define CAST_MARKER_SIZE 64
+// the header size when nothing called cast_resize
+#define CAST_DEFAULT_ROWS 24
+#define CAST_DEFAULT_COLS 80
+
+enum CastEntryType { CAST_OUTPUT, CAST_RESIZE, CAST_MARKER };
+
+// Precedes the bytes of every entry in the queue. A resize carries no bytes,
+// a marker its label.
+struct CastEntry {
+  int64_t time;
+  uint32_t length;
+  uint16_t rows, cols;
+  enum CastEntryType type;
+};
+
+// head and tail count bytes and only grow, a byte is at its count modulo
+// CAST_QUEUE_SIZE. Output is written by one thread at a time, but resizes
+// come from the main thread, so producers take cast_lock.
+char *cast_queue;
+atomic_size_t cast_head;
+atomic_size_t cast_tail;
+pthread_mutex_t cast_lock = PTHREAD_MUTEX_INITIALIZER;
+// entries were dropped since the last marker, with this many bytes of output,
+// guarded by cast_lock
+bool cast_dropping;
+uint64_t cast_dropped_bytes;
+uint64_t cast_dropped_total;
+
+atomic_bool casting;
+atomic_bool cast_stopping;
+pthread_t cast_writer;
+int64_t cast_origin;
+// the size of the first cast_resize, the header waits for it
+atomic_bool cast_size_known;
+unsigned int cast_rows, cast_cols;
+bool cast_header_written;
+
+FILE *cast_file;
+char *cast_file_buffer;
+#ifdef CAST_DEFLATE
+gzFile cast_gz;
+#endif
+char *cast_line;
+// the start of a UTF-8 sequence that continues in the next output
+char cast_carry[4];
+unsigned int cast_carry_length;
+
+///////////////
+// Recording //
+///////////////
+
+void queue_bytes(size_t head, const void *bytes, size_t length) {
+  size_t offset = head % CAST_QUEUE_SIZE;
+  size_t first = CAST_QUEUE_SIZE - offset;
+  first = first < length ? first : length;
+  memcpy(cast_queue + offset, bytes, first);
+  memcpy(cast_queue, (const char *)bytes + first, length - first);
+}
+
+bool queue_fits(size_t head, size_t size) {
+  size_t tail = atomic_load_explicit(&cast_tail, memory_order_acquire);
+  return head + size - tail <= CAST_QUEUE_SIZE;
+}
+
+void push_entry(size_t *head, struct CastEntry *entry, const char *bytes) {
+  queue_bytes(*head, entry, sizeof(*entry));
+  queue_bytes(*head + sizeof(*entry), bytes, entry->length);
+  *head += sizeof(*entry) + entry->length;
+}
+
+// Output is written from the game and the render thread, which must never
+// wait for the writer. When the queue is full the entry is dropped, the next
+// one that fits is preceded by a marker saying how much output was lost.
+void queue_entry(struct CastEntry *entry, const char *bytes) {
+  size_t size = sizeof(*entry) + entry->length;
+  pthread_mutex_lock(&cast_lock);
+  size_t head = atomic_load_explicit(&cast_head, memory_order_relaxed);
+
+  if (cast_dropping) {
+    char label[CAST_MARKER_SIZE];
+    int length = snprintf(label, sizeof(label), "dropped %llu bytes of output",
+                          (unsigned long long)cast_dropped_bytes);
+    struct CastEntry marker = {entry->time, length, 0, 0, CAST_MARKER};
+    if (queue_fits(head, sizeof(marker) + length + size)) {
+      push_entry(&head, &marker, label);
+      cast_dropping = false;
+      cast_dropped_bytes = 0;
+    }
+  }
+  if (!cast_dropping && queue_fits(head, size)) {
+    push_entry(&head, entry, bytes);
+  } else {
+    cast_dropping = true;
+    cast_dropped_bytes += entry->length;
+    cast_dropped_total += entry->length;
+    trace_instant("cast output dropped", entry->time);
+  }
+
+  atomic_store_explicit(&cast_head, head, memory_order_release);
+  pthread_mutex_unlock(&cast_lock);
+}
+
+void cast_output(const char *bytes, size_t length, void *context) {
+  (void)context;
+  if (!atomic_load_explicit(&casting, memory_order_relaxed)) {
+    return;
+  }
+  int64_t time = now();
+  while (length > 0) {
+    struct CastEntry entry = {time, length, 0, 0, CAST_OUTPUT};
+    if (entry.length > CAST_MAX_CHUNK) {
+      entry.length = CAST_MAX_CHUNK;
+    }
+    queue_entry(&entry, bytes);
+    bytes += entry.length;
+    length -= entry.length;
+  }
+}
+
+void cast_resize(unsigned int rows, unsigned int cols) {
+  if (!atomic_load(&casting)) {
+    return;
+  }
+  if (!atomic_load(&cast_size_known)) {
+    cast_rows = rows;
+    cast_cols = cols;
+    atomic_store(&cast_size_known, true);
+  }
+  struct CastEntry entry = {now(), 0, rows, cols, CAST_RESIZE};
+  queue_entry(&entry, NULL);
+}
+
+/////////////
+// Writing //
+/////////////
+
+void write_cast(const char *bytes, size_t length) {
+#ifdef CAST_DEFLATE
+  if (cast_gz) {
+    gzwrite(cast_gz, bytes, length);
+    return;
+  }
+#endif
+  fwrite(bytes, 1, length, cast_file);
+}
+
+// Appends bytes as the content of a JSON string and returns the new end of
+// out. Invalid UTF-8 becomes U+FFFD, a sequence cut off at the end is
+// carried over to the next call, or also becomes U+FFFD when nothing follows.
+char *escape_json(char *out, const char *bytes, size_t length, bool last) {
+  static const char hex[] = "0123456789abcdef";
+  const char *s = bytes;
+  const char *end = s + length;
+  while (s < end) {
+    uint32_t codepoint;
+    size_t sequence = decode_utf8(s, end - s, &codepoint);
+    if (sequence == 0 && last) {
+      memcpy(out, "\\ufffd", 6);
+      out += 6;
+      break;
+    }
+    if (sequence == 0) {
+      cast_carry_length = end - s;
+      memcpy(cast_carry, s, cast_carry_length);
+      break;
+    }
+    if (codepoint == 0xFFFD) {
+      memcpy(out, "\\ufffd", 6);
+      out += 6;
+      s += sequence;
+      continue;
+    }
+    if (sequence > 1) {
+      memcpy(out, s, sequence);
+      out += sequence;
+      s += sequence;
+      continue;
+    }
+
+    unsigned char c = *s++;
+    if (c == '"' || c == '\\') {
+      *out++ = '\\';
+      *out++ = c;
+    } else if (c < 0x20 || c == 0x7f) {
+      memcpy(out, "\\u00", 4);
+      out[4] = hex[c >> 4];
+      out[5] = hex[c & 0xF];
+      out += 6;
+    } else {
+      *out++ = c;
+    }
+  }
+  return out;
+}
+
+void write_cast_header(void) {
+  const char *term = getenv("TERM");
+  char *line = cast_line;
+  line += sprintf(line,
+                  "{\"version\": 2, \"width\": %u, \"height\": %u, "
+                  "\"timestamp\": %lld, \"env\": {\"TERM\": \"",
+                  cast_cols, cast_rows, (long long)time(NULL));
+  term = term ? term : "";
+  line = escape_json(line, term, strlen(term), true);
+  line += sprintf(line, "\"}}\n");
+  write_cast(cast_line, line - cast_line);
+  cast_header_written = true;
+}
+
+void read_queue(size_t tail, void *out, size_t length) {
+  size_t offset = tail % CAST_QUEUE_SIZE;
+  size_t first = CAST_QUEUE_SIZE - offset;
+  first = first < length ? first : length;
+  memcpy(out, cast_queue + offset, first);
+  memcpy((char *)out + first, cast_queue, length - first);
+}
+
+// Starts an event line at line with its time in seconds since the start.
+char *start_cast_event(char *line, int64_t time) {
+  time -= cast_origin;
+  return line + sprintf(line, "[%lld.%06lld, ",
+                        (long long)(time / NANOSECONDS_PER_SECOND),
+                        (long long)(time % NANOSECONDS_PER_SECOND /
+                                    NANOSECONDS_PER_MICROSECOND));
+}
+
+void write_cast_entry(struct CastEntry *entry, size_t tail) {
+  char *line = start_cast_event(cast_line, entry->time);
+
+  if (entry->type == CAST_MARKER) {
+    char label[CAST_MARKER_SIZE];
+    read_queue(tail + sizeof(*entry), label, entry->length);
+    line += sprintf(line, "\"m\", \"");
+    line = escape_json(line, label, entry->length, true);
+    line += sprintf(line, "\"]\n");
+    write_cast(cast_line, line - cast_line);
+    return;
+  }
+
+  if (entry->type == CAST_RESIZE) {
+    // the header already has the first size
+    if (entry->rows == cast_rows && entry->cols == cast_cols) {
+      return;
+    }
+    cast_rows = entry->rows;
+    cast_cols = entry->cols;
+    line += sprintf(line, "\"r\", \"%ux%u\"]\n", cast_cols, cast_rows);
+    write_cast(cast_line, line - cast_line);
+    return;
+  }
+
+  // the carried over bytes go in front of the entry's bytes
+  char bytes[sizeof(cast_carry) + CAST_MAX_CHUNK];
+  unsigned int carried = cast_carry_length;
+  memcpy(bytes, cast_carry, carried);
+  cast_carry_length = 0;
+  read_queue(tail + sizeof(*entry), bytes + carried, entry->length);
+
+  line += sprintf(line, "\"o\", \"");
+  line = escape_json(line, bytes, carried + entry->length, false);
+  line += sprintf(line, "\"]\n");
+  write_cast(cast_line, line - cast_line);
+}
+
+// The start of a UTF-8 sequence the last output left behind is written on its
+// own, as U+FFFD.
+void write_cast_carry(void) {
+  if (cast_carry_length == 0) {
+    return;
+  }
+  char *line = start_cast_event(cast_line, now());
+  line += sprintf(line, "\"o\", \"");
+  line = escape_json(line, cast_carry, cast_carry_length, true);
+  line += sprintf(line, "\"]\n");
+  write_cast(cast_line, line - cast_line);
+  cast_carry_length = 0;
+}
+
+void write_cast_queue(void) {
+  if (!cast_header_written) {
+    if (!atomic_load(&cast_size_known)) {
+      return;
+    }
+    write_cast_header();
+  }
+
+  size_t tail = atomic_load_explicit(&cast_tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&cast_head, memory_order_acquire);
+  while (tail != head) {
+    struct CastEntry entry;
+    read_queue(tail, &entry, sizeof(entry));
+    write_cast_entry(&entry, tail);
+    tail += sizeof(entry) + entry.length;
+  }
+  atomic_store_explicit(&cast_tail, tail, memory_order_release);
+}
+
+void *cast_writer_loop(void *argument) {
+  (void)argument;
+  struct timespec interval = nanoseconds_to_timespec(CAST_WRITE_INTERVAL);
+  while (!atomic_load(&cast_stopping)) {
+    nanosleep(&interval, NULL);
+    write_cast_queue();
+  }
+  return NULL;
+}
+
+////////////////
+// Public Api //
+////////////////
+
+void free_cast(void) {
+  if (cast_file) {
+    fclose(cast_file);
+    cast_file = NULL;
+  }
+#ifdef CAST_DEFLATE
+  if (cast_gz) {
+    gzclose(cast_gz);
+    cast_gz = NULL;
+  }
+#endif
+  free(cast_file_buffer);
+  free(cast_line);
+  free(cast_queue);
+  cast_file_buffer = cast_line = cast_queue = NULL;
+}
+
+bool open_cast_file(const char *path) {
+  size_t length = strlen(path);
+  if (length > 3 && strcmp(path + length - 3, ".gz") == 0) {
+#ifdef CAST_DEFLATE
+    cast_gz = gzopen(path, "wb");
+    return cast_gz != NULL;
+#else
+    fprintf(stderr, "Built without CAST_DEFLATE, can not compress %s.\n",
+            path);
+    return false;
+#endif
+  }
+
+  cast_file = fopen(path, "w");
+  if (cast_file) {
+    setvbuf(cast_file, cast_file_buffer, _IOFBF, CAST_FILE_BUFFER_SIZE);
+  }
+  return cast_file != NULL;
+}
+
+bool start_cast(const char *path) {
+  cast_queue = malloc(CAST_QUEUE_SIZE);
+  cast_line = malloc(CAST_LINE_SIZE);
+  cast_file_buffer = malloc(CAST_FILE_BUFFER_SIZE);
+  if (!cast_queue || !cast_line || !cast_file_buffer ||
+      !open_cast_file(path)) {
+    free_cast();
+    return false;
+  }
+  cast_origin = now();
+
+  if (start_thread(&cast_writer, cast_writer_loop) != 0) {
+    free_cast();
+    return false;
+  }
+
+  atomic_store(&casting, true);
+  output_tee(cast_output, NULL);
+  atexit(stop_cast);
+  return true;
+}
+
+void stop_cast(void) {
+  if (!atomic_exchange(&casting, false)) {
+    return;
+  }
+  output_tee(NULL, NULL);
+  atomic_store(&cast_stopping, true);
+  pthread_join(cast_writer, NULL);
+  // without a size nothing could be written, the header gets a made up one
+  if (!atomic_load(&cast_size_known)) {
+    cast_rows = CAST_DEFAULT_ROWS;
+    cast_cols = CAST_DEFAULT_COLS;
+    atomic_store(&cast_size_known, true);
+  }
+  write_cast_queue();
+  write_cast_carry();
+  free_cast();
+  if (cast_dropped_total > 0) {
+    fprintf(stderr,
+            "The cast lost %llu bytes of output, its writer fell behind.\n",
+            (unsigned long long)cast_dropped_total);
+  }
+}
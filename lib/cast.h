@@ -0,0 +1,27 @@
+#ifndef cast_h
+#define cast_h
+#include <stdbool.h>
+#include <stddef.h>
+
+// Records everything written to the terminal as an asciicast v2 file, which
+// asciinema and other standard players play back. cast_output only copies
+// the bytes into a bounded queue, a background thread formats them and
+// writes the file. Output that does not fit into the queue is dropped, a
+// marker event in the cast says where and how much. Paths ending in .gz are
+// written deflate compressed when built with -DCAST_DEFLATE and -lz, gunzip
+// gives back the plain cast.
+
+// Call it before the terminal is set up so that its setup is recorded too.
+// It hands output_tee every byte written to the terminal. Returns false when
+// the file or the writer thread could not be created.
+bool start_cast(const char *path);
+// Writes what is left and closes the file, start_cast registers it with
+// atexit.
+void stop_cast(void);
+// The first call sets the size in the header, which the writer waits for,
+// later calls record a resize.
+void cast_resize(unsigned int rows, unsigned int cols);
+// An OutputSink for output_tee.
+void cast_output(const char *bytes, size_t length, void *context);
+
+#endif
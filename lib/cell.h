@@ -0,0 +1,12 @@
+#ifndef cell_h
+#define cell_h
+#include <stdint.h>
+
+// A frame buffer cell: one unicode codepoint and the id of an interned style.
+// Two cells are equal exactly when both 32 bit words are equal.
+struct Cell {
+  uint32_t codepoint;
+  uint32_t style;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "events.h"
+#include "timing.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 3
+
+int epoll_fd = -1;
+int timer_fd = -1;
+int signal_fd = -1;
+uint64_t timer_expirations;
+
+void free_events(void) {
+  close(epoll_fd);
+  close(timer_fd);
+  close(signal_fd);
+  epoll_fd = timer_fd = signal_fd = -1;
+}
+
+bool watch(int fd, enum Event event) {
+  struct epoll_event e = {.events = EPOLLIN, .data.u32 = event};
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &e) == 0;
+}
+
+bool init_events(int64_t first_tick, int64_t period) {
+  // blocked in every thread, so they are only ever read from signal_fd
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGWINCH);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  sigaddset(&signals, SIGINT);
+  if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+    return false;
+  }
+
+  signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (signal_fd == -1 || timer_fd == -1 || epoll_fd == -1) {
+    free_events();
+    return false;
+  }
+
+  struct itimerspec timer;
+  timer.it_value = nanoseconds_to_timespec(first_tick);
+  timer.it_interval = nanoseconds_to_timespec(period);
+  if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) != 0 ||
+      !watch(STDIN_FILENO, EVENT_INPUT) || !watch(timer_fd, EVENT_FRAME) ||
+      !watch(signal_fd, EVENT_RESIZE)) {
+    free_events();
+    return false;
+  }
+
+  timer_expirations = 0;
+  atexit(free_events);
+  return true;
+}
+
+unsigned int read_signals(void) {
+  unsigned int result = 0;
+  struct signalfd_siginfo info;
+  while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    result |= info.ssi_signo == SIGWINCH ? EVENT_RESIZE : EVENT_TERMINATE;
+  }
+  return result;
+}
+
+unsigned int wait_for_events(void) {
+  struct epoll_event events[MAX_EVENTS];
+  int count;
+  while ((count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1)) < 0 &&
+         errno == EINTR) {
+  }
+
+  unsigned int result = 0;
+  for (int i = 0; i < count; i++) {
+    switch (events[i].data.u32) {
+    case EVENT_INPUT:
+      // a closed terminal keeps reporting a hangup and nothing to read
+      if (events[i].events & EPOLLIN) {
+        result |= EVENT_INPUT;
+      } else {
+        result |= EVENT_TERMINATE;
+      }
+      break;
+    case EVENT_FRAME: {
+      uint64_t expirations;
+      if (read(timer_fd, &expirations, sizeof(expirations)) ==
+          sizeof(expirations)) {
+        timer_expirations += expirations;
+        result |= EVENT_FRAME;
+      }
+      break;
+    }
+    case EVENT_RESIZE:
+      result |= read_signals();
+      break;
+    }
+  }
+  return result;
+}
+
+int start_thread(pthread_t *thread, void *(*run)(void *)) {
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &previous);
+  int error = pthread_create(thread, NULL, run, NULL);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  return error;
+}
+
+uint64_t frame_ticks(void) {
+  uint64_t ticks = timer_expirations;
+  timer_expirations = 0;
+  return ticks;
+}
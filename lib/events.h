@@ -0,0 +1,32 @@
+#ifndef events_h
+#define events_h
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// One epoll set over stdin, a periodic frame timer (timerfd) and the signals
+// the game reacts to (signalfd), so input is handled the moment it arrives,
+// resizes are applied between frames instead of in a signal handler, and the
+// process sleeps while nothing happens.
+enum Event {
+  EVENT_INPUT = 1,
+  EVENT_FRAME = 2,
+  EVENT_RESIZE = 4,
+  EVENT_TERMINATE = 8,
+};
+
+// The frame timer first fires at first_tick (CLOCK_MONOTONIC nanoseconds) and
+// then every period. SIGWINCH, SIGTERM, SIGHUP and SIGINT are blocked and
+// reported as events from here on.
+bool init_events(int64_t first_tick, int64_t period);
+// Blocks until something happens and returns a mask of enum Event.
+unsigned int wait_for_events(void);
+// Timer expirations since the last call, more than one means frames were
+// missed.
+uint64_t frame_ticks(void);
+// Starts a thread with every signal blocked, so signals reach only the
+// threads that existed before, whether or not init_events ran yet. Returns
+// the error of pthread_create.
+int start_thread(pthread_t *thread, void *(*run)(void *));
+
+#endif
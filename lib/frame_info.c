@@ -1,11 +1,23 @@
 #include "frame_info.h"
+#include "timing.h"
+#include "trace.h"
 #include <stdio.h>
+#include <string.h>
+
+static const char *phase_names[PHASE_COUNT] = {
+    "input", "update", "draw", "composite", "scroll", "diff", "flush",
+};
+
+void clear_frame_info(struct FrameInfo *frame) {
+  memset(frame, 0, sizeof(*frame));
+  frame->start = -1;
+  frame->end = -1;
+}
 
 struct FrameInfo *initialize_frame_info(struct FrameInfo *frame_info,
                                         uint16_t size) {
   for (uint16_t i = 0; i < size; i++) {
-    frame_info[i].start = -1;
-    frame_info[i].end = -1;
+    clear_frame_info(&frame_info[i]);
   }
 
   return &frame_info[0];
@@ -14,66 +26,191 @@ struct FrameInfo *initialize_frame_info(struct FrameInfo *frame_info,
 struct FrameInfoBuffer
 initialize_frame_info_buffer(struct FrameInfo *frame_info, uint16_t size) {
   struct FrameInfoBuffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
   buffer.frame_info = frame_info;
   buffer.current_frame = frame_info;
   buffer.current_frame_index = 0;
   buffer.length = size;
 
   for (uint16_t i = 0; i < size; i++) {
-    frame_info[i].start = -1;
-    frame_info[i].end = -1;
+    clear_frame_info(&frame_info[i]);
   }
 
   return buffer;
 }
 
+/////////////////////////////
+// Log Bucketed Histograms //
+/////////////////////////////
+
+unsigned int histogram_bucket(int64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return value < 0 ? 0 : value;
+  }
+  if (value >> HISTOGRAM_MAX_BITS) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+  // the highest bit picks the power of two, the bits below it the sub bucket
+  int exponent = 63 - __builtin_clzll(value);
+  int shift = exponent - HISTOGRAM_SUB_BITS;
+  return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (value >> shift) -
+         HISTOGRAM_SUB_BUCKETS;
+}
+
+// the largest value counted in the bucket
+int64_t histogram_bucket_value(unsigned int bucket) {
+  if (bucket < HISTOGRAM_SUB_BUCKETS) {
+    return bucket;
+  }
+  int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+  int64_t sub_bucket = bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+void histogram_add(struct Histogram *h, int64_t value) {
+  h->counts[histogram_bucket(value)]++;
+  h->total++;
+}
+
+void histogram_remove(struct Histogram *h, int64_t value) {
+  h->counts[histogram_bucket(value)]--;
+  h->total--;
+}
+
+bool histogram_percentiles(const struct Histogram *h, const int *per_mille,
+                           int64_t *values, int count) {
+  if (h->total == 0) {
+    return false;
+  }
+
+  int found = 0;
+  uint64_t seen = 0;
+  for (unsigned int bucket = 0; bucket < HISTOGRAM_BUCKETS && found < count;
+       bucket++) {
+    seen += h->counts[bucket];
+    // seen / total >= per_mille / 1000, with at least one value seen
+    while (found < count && seen > 0 &&
+           seen * 1000 >= (uint64_t)h->total * per_mille[found]) {
+      values[found++] = histogram_bucket_value(bucket);
+    }
+  }
+  return true;
+}
+
+//////////////////////
+// Frame Statistics //
+//////////////////////
+
+bool frame_completed(struct FrameInfo *frame) {
+  return frame->start != -1 && frame->end != -1;
+}
+
+// Adds a frame to the statistics of the ring with sign 1, or removes it with
+// sign -1. The counters wrap, so removing gives back what was added.
+void count_frame(struct FrameInfoBuffer *b, struct FrameInfo *frame,
+                 int sign) {
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    b->total.phases[phase] += sign * frame->phases[phase];
+  }
+  struct RenderCounters *to = &b->total.counters;
+  struct RenderCounters *from = &frame->counters;
+  to->cells_diffed += sign * from->cells_diffed;
+  to->cells_emitted += sign * from->cells_emitted;
+  to->cursor_moves += sign * from->cursor_moves;
+  to->sgr_changes += sign * from->sgr_changes;
+  to->bytes_written += sign * from->bytes_written;
+  to->write_calls += sign * from->write_calls;
+
+  int64_t active_time = frame->end - frame->start;
+  b->total_active_time += sign * active_time;
+  b->count += sign;
+  if (sign > 0) {
+    histogram_add(&b->active_times, active_time);
+  } else {
+    histogram_remove(&b->active_times, active_time);
+  }
+}
+
 void advance_frame_info_buffer(struct FrameInfoBuffer *b) {
+  if (frame_completed(b->current_frame)) {
+    count_frame(b, b->current_frame, 1);
+  }
   b->current_frame_index = (b->current_frame_index + 1) % b->length;
   b->current_frame = &b->frame_info[b->current_frame_index];
+  // the oldest frame makes room
+  if (frame_completed(b->current_frame)) {
+    count_frame(b, b->current_frame, -1);
+  }
+  clear_frame_info(b->current_frame);
 }
 
-int average_active_time(struct FrameInfoBuffer *b) {
-  int64_t total_active_time = 0;
-  uint16_t count = 0;
-  for (uint16_t i = 0; i < b->length; i++) {
-    if (i == b->current_frame_index)
-      continue;
-    if (b->frame_info[i].start == -1 || b->frame_info[i].end == -1)
-      continue;
-    count++;
-    total_active_time += b->frame_info[i].end - b->frame_info[i].start;
-  }
-  if (count == 0) {
+int64_t average_active_time(struct FrameInfoBuffer *b) {
+  if (b->count == 0) {
     return -1;
   }
-  return total_active_time / count;
+  return b->total_active_time / b->count;
+}
+
+bool active_time_percentiles(struct FrameInfoBuffer *b, const int *per_mille,
+                             int64_t *values, int count) {
+  return histogram_percentiles(&b->active_times, per_mille, values, count);
 }
 
 int average_fps(struct FrameInfoBuffer *b) {
-  int64_t minimum_start = INT64_MAX;
-  int64_t maximum_start = 0;
+  if (b->count < 2) {
+    return -1;
+  }
 
-  unsigned int count = 0;
+  // the completed frames are the ones right before the current frame
+  uint16_t newest = (b->current_frame_index + b->length - 1) % b->length;
+  uint16_t oldest = (b->current_frame_index + b->length - b->count) % b->length;
 
-  for (uint16_t i = 0; i < b->length; i++) {
-    if (b->frame_info[i].start == -1) {
-      continue;
-    }
+  // count frame starts span count - 1 frames
+  int64_t duration = b->frame_info[newest].start - b->frame_info[oldest].start;
+  if (duration <= 0) {
+    return -1;
+  }
 
-    count++;
+  return ((b->count - 1) * NANOSECONDS_PER_SECOND + duration / 2) / duration;
+}
 
-    if (b->frame_info[i].start < minimum_start) {
-      minimum_start = b->frame_info[i].start;
-    }
-    if (b->frame_info[i].start > maximum_start) {
-      maximum_start = b->frame_info[i].start;
-    }
+void end_phase(struct FrameInfo *frame, enum FramePhase phase, int64_t *mark) {
+  int64_t time = now();
+  frame->phases[phase] += time - *mark;
+  trace_span(phase_names[phase], *mark, time);
+  *mark = time;
+}
+
+void add_frame_profile(struct FrameInfo *to, const struct FrameInfo *from) {
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    to->phases[phase] += from->phases[phase];
   }
+  to->counters.cells_diffed += from->counters.cells_diffed;
+  to->counters.cells_emitted += from->counters.cells_emitted;
+  to->counters.cursor_moves += from->counters.cursor_moves;
+  to->counters.sgr_changes += from->counters.sgr_changes;
+  to->counters.bytes_written += from->counters.bytes_written;
+  to->counters.write_calls += from->counters.write_calls;
+}
 
-  int duration = maximum_start - minimum_start;
-  if (duration == 0) {
-    return -1;
+bool average_frame_profile(struct FrameInfoBuffer *b,
+                           struct FrameInfo *average) {
+  clear_frame_info(average);
+  if (b->count == 0) {
+    return false;
   }
 
-  return count * 1000 / duration;
+  add_frame_profile(average, &b->total);
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    average->phases[phase] /= b->count;
+  }
+  average->counters.cells_diffed /= b->count;
+  average->counters.cells_emitted /= b->count;
+  average->counters.cursor_moves /= b->count;
+  average->counters.sgr_changes /= b->count;
+  average->counters.bytes_written /= b->count;
+  average->counters.write_calls /= b->count;
+  return true;
 }
+
+const char *phase_name(enum FramePhase phase) { return phase_names[phase]; }
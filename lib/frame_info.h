@@ -1,18 +1,78 @@
 #ifndef FRAME_INFO_H
 #define FRAME_INFO_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+// Where the time of a frame goes. The first phases belong to the main loop,
+// the others to render_frame. Diffing and encoding escape sequences happen in
+// the same pass over a row, PHASE_DIFF covers both.
+enum FramePhase {
+  PHASE_INPUT,
+  PHASE_UPDATE,
+  PHASE_DRAW,
+  PHASE_COMPOSITE,
+  PHASE_SCROLL,
+  PHASE_DIFF,
+  PHASE_FLUSH,
+  PHASE_COUNT,
+};
+
+// what the renderer did for a frame
+struct RenderCounters {
+  uint32_t cells_diffed;
+  uint32_t cells_emitted;
+  uint32_t cursor_moves;
+  uint32_t sgr_changes;
+  uint32_t bytes_written;
+  uint32_t write_calls;
+};
+
+// start and end of a frame in nanoseconds, see now(), and the nanoseconds
+// spent in each phase since the previous frame
 struct FrameInfo {
   int64_t start;
   int64_t end;
+  int64_t phases[PHASE_COUNT];
+  struct RenderCounters counters;
 };
 
+// Log bucketed histogram of durations in nanoseconds. Each power of two is
+// split into HISTOGRAM_SUB_BUCKETS buckets, so a bucket is within about 6% of
+// the values counted in it. Durations from 2^HISTOGRAM_MAX_BITS nanoseconds,
+// about 18 minutes, on share the last bucket.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS                                                      \
+  ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct Histogram {
+  uint32_t counts[HISTOGRAM_BUCKETS];
+  uint32_t total;
+};
+
+void histogram_add(struct Histogram *h, int64_t value);
+void histogram_remove(struct Histogram *h, int64_t value);
+// Fills values with the smallest durations that at least the given per mille
+// of the counted durations do not exceed, in ascending order of per_mille.
+// 1000 per mille is the maximum. Returns false when nothing was counted.
+bool histogram_percentiles(const struct Histogram *h, const int *per_mille,
+                           int64_t *values, int count);
+
+// The statistics of the completed frames in the ring are kept up to date by
+// advance_frame_info_buffer, reading them does not scan the ring.
 struct FrameInfoBuffer {
   struct FrameInfo *frame_info;
   struct FrameInfo *current_frame;
   uint16_t current_frame_index;
   uint16_t length;
+  // completed frames in the ring, the sum of their phases and counters and
+  // their active times
+  uint16_t count;
+  struct FrameInfo total;
+  int64_t total_active_time;
+  struct Histogram active_times;
 };
 
 struct FrameInfo *initialize_frame_info(struct FrameInfo *frame_info,
@@ -23,8 +83,21 @@ initialize_frame_info_buffer(struct FrameInfo *frame_info, uint16_t size);
 
 void advance_frame_info_buffer(struct FrameInfoBuffer *b);
 
-int average_active_time(struct FrameInfoBuffer *b);
+int64_t average_active_time(struct FrameInfoBuffer *b);
+// Active time percentiles of the completed frames, see histogram_percentiles.
+bool active_time_percentiles(struct FrameInfoBuffer *b, const int *per_mille,
+                             int64_t *values, int count);
 
 int average_fps(struct FrameInfoBuffer *b);
 
+// Adds the time since *mark to the phase of the frame and moves *mark to now.
+// The phase is recorded as a span when tracing.
+void end_phase(struct FrameInfo *frame, enum FramePhase phase, int64_t *mark);
+void add_frame_profile(struct FrameInfo *to, const struct FrameInfo *from);
+// Averages phases and counters of the recent frames into average, returns
+// false when there are none yet.
+bool average_frame_profile(struct FrameInfoBuffer *b,
+                           struct FrameInfo *average);
+const char *phase_name(enum FramePhase phase);
+
 #endif
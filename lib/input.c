@@ -0,0 +1,569 @@
+#include "input.h"
+#include <string.h>
+
+#define PASTE_START 200
+#define PASTE_END 201
+// a parameter stops growing here, no key needs more digits
+#define MAX_PARAMETER 9999
+
+// What a byte is to the state machine. '[' and 'O' get their own classes
+// because they turn an ESC into CSI and SS3.
+enum ByteClass {
+  BYTE_CONTROL,      // 0x00-0x1F but ESC
+  BYTE_ESCAPE,       // 0x1B
+  BYTE_INTERMEDIATE, // 0x20-0x2F
+  BYTE_PARAMETER,    // 0x30-0x3F
+  BYTE_FINAL,        // 0x40-0x7E but '[' and 'O'
+  BYTE_BRACKET,      // '['
+  BYTE_O,            // 'O'
+  BYTE_DELETE,       // 0x7F
+  BYTE_CONTINUATION, // 0x80-0xBF
+  BYTE_LEAD_2,       // 0xC2-0xDF
+  BYTE_LEAD_3,       // 0xE0-0xEF
+  BYTE_LEAD_4,       // 0xF0-0xF4
+  BYTE_INVALID,      // 0xC0, 0xC1, 0xF5-0xFF
+  BYTE_CLASS_COUNT,
+};
+
+enum InputAction {
+  // the byte is dropped
+  ACTION_IGNORE,
+  ACTION_CHARACTER,
+  ACTION_CONTROL,
+  ACTION_ESCAPE,
+  // an ESC after an ESC, the first was a key of its own
+  ACTION_ESCAPE_KEY,
+  ACTION_CSI,
+  ACTION_SS3,
+  ACTION_PARAMETER,
+  ACTION_CSI_DISPATCH,
+  ACTION_SS3_DISPATCH,
+  ACTION_UTF8_START,
+  ACTION_UTF8_CONTINUE,
+  ACTION_INVALID,
+  // the sequence is broken off, the byte is decoded again from the ground
+  ACTION_INTERRUPT,
+  ACTION_X10_MOUSE,
+};
+
+struct Transition {
+  uint8_t action;
+  uint8_t next;
+};
+
+// clang-format off
+// keys that are the same with or without an ESC before them
+#define KEYS                                                                  \
+  [BYTE_CONTROL] = {ACTION_CONTROL, INPUT_GROUND},                            \
+  [BYTE_INTERMEDIATE] = {ACTION_CHARACTER, INPUT_GROUND},                     \
+  [BYTE_PARAMETER] = {ACTION_CHARACTER, INPUT_GROUND},                        \
+  [BYTE_FINAL] = {ACTION_CHARACTER, INPUT_GROUND},                            \
+  [BYTE_DELETE] = {ACTION_CONTROL, INPUT_GROUND},                             \
+  [BYTE_CONTINUATION] = {ACTION_INVALID, INPUT_GROUND},                       \
+  [BYTE_LEAD_2] = {ACTION_UTF8_START, INPUT_UTF8},                            \
+  [BYTE_LEAD_3] = {ACTION_UTF8_START, INPUT_UTF8},                            \
+  [BYTE_LEAD_4] = {ACTION_UTF8_START, INPUT_UTF8},                            \
+  [BYTE_INVALID] = {ACTION_INVALID, INPUT_GROUND}
+
+const struct Transition transitions[INPUT_STATE_COUNT][BYTE_CLASS_COUNT] = {
+  [INPUT_GROUND] = {
+    KEYS,
+    [BYTE_ESCAPE] = {ACTION_ESCAPE, INPUT_ESCAPE},
+    [BYTE_BRACKET] = {ACTION_CHARACTER, INPUT_GROUND},
+    [BYTE_O] = {ACTION_CHARACTER, INPUT_GROUND},
+  },
+  // anything but a sequence is the key after it with MOD_ALT
+  [INPUT_ESCAPE] = {
+    KEYS,
+    [BYTE_ESCAPE] = {ACTION_ESCAPE_KEY, INPUT_ESCAPE},
+    [BYTE_BRACKET] = {ACTION_CSI, INPUT_CSI},
+    [BYTE_O] = {ACTION_SS3, INPUT_SS3},
+  },
+  [INPUT_CSI] = {
+    [BYTE_CONTROL] = {ACTION_IGNORE, INPUT_CSI},
+    [BYTE_ESCAPE] = {ACTION_ESCAPE, INPUT_ESCAPE},
+    [BYTE_INTERMEDIATE] = {ACTION_IGNORE, INPUT_CSI},
+    [BYTE_PARAMETER] = {ACTION_PARAMETER, INPUT_CSI},
+    [BYTE_FINAL] = {ACTION_CSI_DISPATCH, INPUT_GROUND},
+    [BYTE_BRACKET] = {ACTION_CSI_DISPATCH, INPUT_GROUND},
+    [BYTE_O] = {ACTION_CSI_DISPATCH, INPUT_GROUND},
+    [BYTE_DELETE] = {ACTION_IGNORE, INPUT_CSI},
+    [BYTE_CONTINUATION] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_LEAD_2] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_LEAD_3] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_LEAD_4] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_INVALID] = {ACTION_INTERRUPT, INPUT_GROUND},
+  },
+  // some terminals put modifiers between SS3 and the final byte
+  [INPUT_SS3] = {
+    [BYTE_CONTROL] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_ESCAPE] = {ACTION_ESCAPE, INPUT_ESCAPE},
+    [BYTE_INTERMEDIATE] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_PARAMETER] = {ACTION_PARAMETER, INPUT_SS3},
+    [BYTE_FINAL] = {ACTION_SS3_DISPATCH, INPUT_GROUND},
+    [BYTE_BRACKET] = {ACTION_SS3_DISPATCH, INPUT_GROUND},
+    [BYTE_O] = {ACTION_SS3_DISPATCH, INPUT_GROUND},
+    [BYTE_DELETE] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_CONTINUATION] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_LEAD_2] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_LEAD_3] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_LEAD_4] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_INVALID] = {ACTION_INTERRUPT, INPUT_GROUND},
+  },
+  // a cut off character becomes U+FFFD, the byte that cut it off is decoded
+  // on its own
+  [INPUT_UTF8] = {
+    [BYTE_CONTROL] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_ESCAPE] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_INTERMEDIATE] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_PARAMETER] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_FINAL] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_BRACKET] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_O] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_DELETE] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_CONTINUATION] = {ACTION_UTF8_CONTINUE, INPUT_UTF8},
+    [BYTE_LEAD_2] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_LEAD_3] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_LEAD_4] = {ACTION_INTERRUPT, INPUT_GROUND},
+    [BYTE_INVALID] = {ACTION_INTERRUPT, INPUT_GROUND},
+  },
+  // the button and the position come as single bytes of any value
+  [INPUT_X10_MOUSE] = {
+    [BYTE_CONTROL] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_ESCAPE] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_INTERMEDIATE] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_PARAMETER] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_FINAL] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_BRACKET] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_O] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_DELETE] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_CONTINUATION] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_LEAD_2] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_LEAD_3] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_LEAD_4] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+    [BYTE_INVALID] = {ACTION_X10_MOUSE, INPUT_X10_MOUSE},
+  },
+};
+// clang-format on
+
+// keys of CSI and SS3 by their final byte
+const enum Key final_keys[128] = {
+    ['A'] = KEY_UP,   ['B'] = KEY_DOWN, ['C'] = KEY_RIGHT, ['D'] = KEY_LEFT,
+    ['H'] = KEY_HOME, ['F'] = KEY_END,  ['Z'] = KEY_BACKTAB, ['P'] = KEY_F1,
+    ['Q'] = KEY_F2,   ['R'] = KEY_F3,   ['S'] = KEY_F4,
+};
+
+// keys of CSI <number> ~ by their number
+const enum Key tilde_keys[25] = {
+    [1] = KEY_HOME,     [2] = KEY_INSERT,     [3] = KEY_DELETE,
+    [4] = KEY_END,      [5] = KEY_PAGE_UP,    [6] = KEY_PAGE_DOWN,
+    [7] = KEY_HOME,     [8] = KEY_END,        [11] = KEY_F1,
+    [12] = KEY_F2,      [13] = KEY_F3,        [14] = KEY_F4,
+    [15] = KEY_F5,      [17] = KEY_F6,        [18] = KEY_F7,
+    [19] = KEY_F8,      [20] = KEY_F9,        [21] = KEY_F10,
+    [23] = KEY_F11,     [24] = KEY_F12,
+};
+
+// the smallest codepoint of a UTF-8 sequence by its continuation bytes
+const uint32_t utf8_minimum[4] = {0, 0x80, 0x800, 0x10000};
+
+// the class of every byte, by its value
+// clang-format off
+#define CT BYTE_CONTROL
+#define ES BYTE_ESCAPE
+#define IM BYTE_INTERMEDIATE
+#define PA BYTE_PARAMETER
+#define FI BYTE_FINAL
+#define BR BYTE_BRACKET
+#define OO BYTE_O
+#define DE BYTE_DELETE
+#define CO BYTE_CONTINUATION
+#define L2 BYTE_LEAD_2
+#define L3 BYTE_LEAD_3
+#define L4 BYTE_LEAD_4
+#define XX BYTE_INVALID
+const uint8_t byte_classes[256] = {
+    CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, // 0x00
+    CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, CT, ES, CT, CT, CT, CT, // 0x10
+    IM, IM, IM, IM, IM, IM, IM, IM, IM, IM, IM, IM, IM, IM, IM, IM, // 0x20
+    PA, PA, PA, PA, PA, PA, PA, PA, PA, PA, PA, PA, PA, PA, PA, PA, // 0x30
+    FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, OO, // 0x40
+    FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, BR, FI, FI, FI, FI, // 0x50
+    FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, // 0x60
+    FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, FI, DE, // 0x70
+    CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, // 0x80
+    CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, // 0x90
+    CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, // 0xA0
+    CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, CO, // 0xB0
+    XX, XX, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, // 0xC0
+    L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, L2, // 0xD0
+    L3, L3, L3, L3, L3, L3, L3, L3, L3, L3, L3, L3, L3, L3, L3, L3, // 0xE0
+    L4, L4, L4, L4, L4, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, // 0xF0
+};
+#undef CT
+#undef ES
+#undef IM
+#undef PA
+#undef FI
+#undef BR
+#undef OO
+#undef DE
+#undef CO
+#undef L2
+#undef L3
+#undef L4
+#undef XX
+// clang-format on
+
+///////////
+// UTF-8 //
+///////////
+
+// Starts a character at its lead byte with the bits the lead byte holds,
+// returns how many continuation bytes follow.
+unsigned int start_utf8(uint8_t lead, uint32_t *codepoint) {
+  unsigned int continuations = byte_classes[lead] - BYTE_LEAD_2 + 1;
+  *codepoint = lead & (0x3F >> continuations);
+  return continuations;
+}
+
+// The complete character, or U+FFFD for overlong forms, surrogates and
+// codepoints beyond U+10FFFF.
+uint32_t finish_utf8(uint32_t codepoint, unsigned int continuations) {
+  bool valid = codepoint >= utf8_minimum[continuations] &&
+               !(codepoint >= 0xD800 && codepoint < 0xE000) &&
+               codepoint <= 0x10FFFF;
+  return valid ? codepoint : 0xFFFD;
+}
+
+//////////////
+// Decoding //
+//////////////
+
+void start_sequence(struct InputDecoder *d) {
+  d->parameter_count = 0;
+  d->private_marker = '\0';
+}
+
+// Control characters come as their letter with MOD_CTRL, but for the ones
+// with keys of their own.
+void control_key(uint8_t byte, struct KeyEvent *event) {
+  switch (byte) {
+  case '\r':
+    event->key = KEY_ENTER;
+    return;
+  case '\t':
+    event->key = KEY_TAB;
+    return;
+  case '\b':
+  case 0x7F:
+    event->key = KEY_BACKSPACE;
+    return;
+  }
+  event->key = KEY_CHARACTER;
+  event->codepoint = byte == 0 ? ' ' : byte <= 26 ? byte + 'a' - 1 : byte + '@';
+  event->modifiers |= MOD_CTRL;
+}
+
+void add_parameter_byte(struct InputDecoder *d, uint8_t byte) {
+  if (byte == ';' || byte == ':') {
+    // an empty first parameter
+    if (d->parameter_count == 0) {
+      d->parameters[0] = 0;
+      d->parameter_count = 1;
+    }
+    if (d->parameter_count < INPUT_MAX_PARAMETERS) {
+      d->parameters[d->parameter_count] = 0;
+    }
+    d->parameter_count++;
+    return;
+  }
+  if (byte < '0' || byte > '9') {
+    d->private_marker = byte;
+    return;
+  }
+  // the first digit starts the first parameter
+  if (d->parameter_count == 0) {
+    d->parameters[0] = 0;
+    d->parameter_count = 1;
+  }
+  if (d->parameter_count <= INPUT_MAX_PARAMETERS) {
+    unsigned int *p = &d->parameters[d->parameter_count - 1];
+    *p = *p * 10 + (byte - '0');
+    *p = *p > MAX_PARAMETER ? MAX_PARAMETER : *p;
+  }
+}
+
+// the parameter at index, or fallback where it is missing or empty
+unsigned int parameter(struct InputDecoder *d, unsigned int index,
+                       unsigned int fallback) {
+  if (index >= d->parameter_count || index >= INPUT_MAX_PARAMETERS ||
+      d->parameters[index] == 0) {
+    return fallback;
+  }
+  return d->parameters[index];
+}
+
+// xterm sends modifiers as one plus their bits in the second parameter
+void add_parameter_modifiers(struct InputDecoder *d, struct KeyEvent *event) {
+  event->modifiers |=
+      (parameter(d, 1, 1) - 1) & (MOD_SHIFT | MOD_ALT | MOD_CTRL);
+}
+
+// Fills in a mouse report from its button byte, in which bits 2 to 4 are the
+// modifiers, bit 5 marks moves and bit 6 the wheel.
+void mouse_report(unsigned int button, enum MouseAction action,
+                  unsigned int x, unsigned int y, struct KeyEvent *event) {
+  event->key = KEY_MOUSE;
+  event->modifiers |= (button >> 2) & (MOD_SHIFT | MOD_ALT | MOD_CTRL);
+  if (button & 64) {
+    event->mouse.button = button & 1 ? MOUSE_WHEEL_DOWN : MOUSE_WHEEL_UP;
+  } else {
+    event->mouse.button = button & 3;
+  }
+  if (button & 32) {
+    action = MOUSE_MOVE;
+  }
+  event->mouse.action = action;
+  event->mouse.x = x;
+  event->mouse.y = y;
+}
+
+bool csi_dispatch(struct InputDecoder *d, uint8_t final,
+                  struct KeyEvent *event) {
+  if (d->private_marker == '<' && (final == 'M' || final == 'm')) {
+    unsigned int x = parameter(d, 1, 1), y = parameter(d, 2, 1);
+    enum MouseAction action = final == 'm' ? MOUSE_RELEASE : MOUSE_PRESS;
+    mouse_report(parameter(d, 0, 0), action, x - 1, y - 1, event);
+    return true;
+  }
+  if (d->private_marker != '\0') {
+    return false;
+  }
+  if (final == 'M' && d->parameter_count == 0) {
+    d->remaining = 3;
+    d->state = INPUT_X10_MOUSE;
+    return false;
+  }
+
+  if (final == '~') {
+    unsigned int number = parameter(d, 0, 0);
+    if (number == PASTE_START || number == PASTE_END) {
+      d->pasting = number == PASTE_START;
+      return false;
+    }
+    if (number >= sizeof(tilde_keys) / sizeof(tilde_keys[0])) {
+      return false;
+    }
+    event->key = tilde_keys[number];
+  } else {
+    event->key = final < 128 ? final_keys[final] : KEY_NONE;
+  }
+  add_parameter_modifiers(d, event);
+  return event->key != KEY_NONE;
+}
+
+bool x10_mouse_byte(struct InputDecoder *d, uint8_t byte,
+                    struct KeyEvent *event) {
+  d->mouse_bytes[3 - d->remaining] = byte;
+  if (--d->remaining > 0) {
+    return false;
+  }
+  d->state = INPUT_GROUND;
+  // every byte is offset by 32, positions start at 1
+  unsigned int button = (uint8_t)(d->mouse_bytes[0] - 32);
+  enum MouseAction action =
+      (button & 3) == 3 && !(button & 64) ? MOUSE_RELEASE : MOUSE_PRESS;
+  mouse_report(button, action, (uint8_t)(d->mouse_bytes[1] - 33),
+               (uint8_t)(d->mouse_bytes[2] - 33), event);
+  return true;
+}
+
+// Runs the action of a transition from the state from, returns whether it
+// completed an event. An action may consume no byte or change the state the
+// transition went to.
+bool run_action(struct InputDecoder *d, enum InputAction action,
+                enum InputState from, uint8_t byte, bool *consumed,
+                struct KeyEvent *event) {
+  switch (action) {
+  case ACTION_IGNORE:
+    return false;
+  case ACTION_CHARACTER:
+    event->key = KEY_CHARACTER;
+    event->codepoint = byte;
+    return true;
+  case ACTION_CONTROL:
+    control_key(byte, event);
+    return true;
+  case ACTION_ESCAPE:
+    start_sequence(d);
+    return false;
+  case ACTION_ESCAPE_KEY:
+    start_sequence(d);
+    event->key = KEY_ESCAPE;
+    event->modifiers = 0;
+    return true;
+  case ACTION_CSI:
+  case ACTION_SS3:
+    start_sequence(d);
+    return false;
+  case ACTION_PARAMETER:
+    add_parameter_byte(d, byte);
+    return false;
+  case ACTION_CSI_DISPATCH:
+    return csi_dispatch(d, byte, event);
+  case ACTION_SS3_DISPATCH:
+    event->key = final_keys[byte];
+    add_parameter_modifiers(d, event);
+    return event->key != KEY_NONE;
+  case ACTION_UTF8_START:
+    d->remaining = start_utf8(byte, &d->codepoint);
+    d->continuations = d->remaining;
+    // keeps MOD_ALT of an ESC before it
+    d->modifiers = from == INPUT_ESCAPE ? MOD_ALT : 0;
+    return false;
+  case ACTION_UTF8_CONTINUE:
+    d->codepoint = d->codepoint << 6 | (byte & 0x3F);
+    if (--d->remaining > 0) {
+      return false;
+    }
+    d->state = INPUT_GROUND;
+    event->key = KEY_CHARACTER;
+    event->codepoint = finish_utf8(d->codepoint, d->continuations);
+    event->modifiers = d->modifiers;
+    return true;
+  case ACTION_INVALID:
+    event->key = KEY_CHARACTER;
+    event->codepoint = 0xFFFD;
+    return true;
+  case ACTION_INTERRUPT:
+    *consumed = false;
+    if (from == INPUT_UTF8) {
+      event->key = KEY_CHARACTER;
+      event->codepoint = 0xFFFD;
+      event->modifiers = d->modifiers;
+      return true;
+    }
+    return false;
+  case ACTION_X10_MOUSE:
+    return x10_mouse_byte(d, byte, event);
+  }
+  return false;
+}
+
+////////////////
+// Public Api //
+////////////////
+
+void init_input_decoder(struct InputDecoder *d) {
+  memset(d, 0, sizeof(*d));
+  d->state = INPUT_GROUND;
+}
+
+unsigned int input_space(struct InputDecoder *d) {
+  return INPUT_RING_SIZE - (d->head - d->tail);
+}
+
+unsigned int feed_input(struct InputDecoder *d, const char *bytes,
+                        unsigned int length) {
+  unsigned int space = input_space(d);
+  length = length < space ? length : space;
+  unsigned int offset = d->head % INPUT_RING_SIZE;
+  unsigned int first = INPUT_RING_SIZE - offset;
+  first = first < length ? first : length;
+  memcpy(d->ring + offset, bytes, first);
+  memcpy(d->ring, bytes + first, length - first);
+  d->head += length;
+  return length;
+}
+
+bool input_pending(struct InputDecoder *d) {
+  return d->head != d->tail || d->state != INPUT_GROUND;
+}
+
+bool next_key_event(struct InputDecoder *d, int64_t time,
+                    struct KeyEvent *event) {
+  while (d->tail != d->head) {
+    uint8_t byte = d->ring[d->tail % INPUT_RING_SIZE];
+    enum InputState from = d->state;
+    struct Transition transition = transitions[from][byte_classes[byte]];
+    bool consumed = true;
+    memset(event, 0, sizeof(*event));
+    // a key right after an ESC is that key with alt
+    if (from == INPUT_ESCAPE) {
+      event->modifiers = MOD_ALT;
+    }
+    d->state = transition.next;
+    bool emitted =
+        run_action(d, transition.action, from, byte, &consumed, event);
+    d->tail += consumed;
+    d->waiting = false;
+    if (emitted) {
+      event->pasted = d->pasting;
+      return true;
+    }
+  }
+
+  if (d->state == INPUT_GROUND) {
+    return false;
+  }
+  if (!d->waiting) {
+    d->waiting = true;
+    d->waiting_since = time;
+    return false;
+  }
+  if (time - d->waiting_since < ESCAPE_TIMEOUT) {
+    return false;
+  }
+
+  // nothing completed the sequence in time, an ESC on its own was a key and
+  // the rest is dropped
+  bool lone_escape = d->state == INPUT_ESCAPE;
+  d->state = INPUT_GROUND;
+  d->waiting = false;
+  if (!lone_escape) {
+    return false;
+  }
+  memset(event, 0, sizeof(*event));
+  event->key = KEY_ESCAPE;
+  event->pasted = d->pasting;
+  return true;
+}
+
+size_t decode_utf8(const char *bytes, size_t length, uint32_t *codepoint) {
+  if (length == 0) {
+    return 0;
+  }
+  uint8_t lead = bytes[0];
+  switch (byte_classes[lead]) {
+  case BYTE_LEAD_2:
+  case BYTE_LEAD_3:
+  case BYTE_LEAD_4:
+    break;
+  case BYTE_CONTINUATION:
+  case BYTE_INVALID:
+    *codepoint = 0xFFFD;
+    return 1;
+  default:
+    *codepoint = lead;
+    return 1;
+  }
+
+  uint32_t c;
+  unsigned int continuations = start_utf8(lead, &c);
+  for (unsigned int i = 1; i <= continuations; i++) {
+    if (i == length) {
+      return 0;
+    }
+    uint8_t byte = bytes[i];
+    // like in next_key_event the byte that cut the character off is not
+    // part of it
+    if (byte_classes[byte] != BYTE_CONTINUATION) {
+      *codepoint = 0xFFFD;
+      return i;
+    }
+    c = c << 6 | (byte & 0x3F);
+  }
+  *codepoint = finish_utf8(c, continuations);
+  return continuations + 1;
+}
@@ -0,0 +1,148 @@
+#ifndef input_h
+#define input_h
+#include "timing.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Decodes what the terminal sends into key events: characters (UTF-8),
+// control keys, CSI and SS3 keys with their modifiers, bracketed pastes and
+// mouse reports in the SGR and the X10 encoding.
+//
+// Bytes are kept in a ring until they are decoded, and the state machine
+// keeps its state between calls, so a sequence split across reads decodes
+// like one that arrived at once. Each byte is classified and looked up in a
+// transition table, nothing is allocated.
+//
+// ESC starts every sequence but is also a key of its own. An ESC nothing
+// follows within ESCAPE_TIMEOUT is reported as KEY_ESCAPE.
+
+// a power of two
+#define INPUT_RING_SIZE 8192
+#define INPUT_MAX_PARAMETERS 8
+#define ESCAPE_TIMEOUT (25 * NANOSECONDS_PER_MILLISECOND)
+
+// bits of KeyEvent.modifiers, as in xterm's modifier parameter minus one
+#define MOD_SHIFT 1
+#define MOD_ALT 2
+#define MOD_CTRL 4
+
+enum Key {
+  KEY_NONE,
+  // a character in codepoint, control characters come as their letter with
+  // MOD_CTRL
+  KEY_CHARACTER,
+  KEY_ENTER,
+  KEY_TAB,
+  KEY_BACKSPACE,
+  KEY_ESCAPE,
+  KEY_UP,
+  KEY_DOWN,
+  KEY_RIGHT,
+  KEY_LEFT,
+  KEY_HOME,
+  KEY_END,
+  KEY_INSERT,
+  KEY_DELETE,
+  KEY_PAGE_UP,
+  KEY_PAGE_DOWN,
+  KEY_BACKTAB,
+  KEY_F1,
+  KEY_F2,
+  KEY_F3,
+  KEY_F4,
+  KEY_F5,
+  KEY_F6,
+  KEY_F7,
+  KEY_F8,
+  KEY_F9,
+  KEY_F10,
+  KEY_F11,
+  KEY_F12,
+  KEY_MOUSE,
+};
+
+enum MouseButton {
+  MOUSE_LEFT,
+  MOUSE_MIDDLE,
+  MOUSE_RIGHT,
+  // moves without a button and X10 releases, which do not say which one
+  MOUSE_NO_BUTTON,
+  MOUSE_WHEEL_UP,
+  MOUSE_WHEEL_DOWN,
+};
+
+enum MouseAction { MOUSE_PRESS, MOUSE_RELEASE, MOUSE_MOVE };
+
+struct MouseReport {
+  enum MouseButton button;
+  enum MouseAction action;
+  // the cell, starting at 0
+  unsigned int x, y;
+};
+
+struct KeyEvent {
+  enum Key key;
+  uint32_t codepoint;
+  uint8_t modifiers;
+  // the key is part of a bracketed paste, not typed
+  bool pasted;
+  struct MouseReport mouse;
+};
+
+enum InputState {
+  INPUT_GROUND,
+  INPUT_ESCAPE,
+  INPUT_CSI,
+  INPUT_SS3,
+  INPUT_UTF8,
+  // the three bytes after CSI M
+  INPUT_X10_MOUSE,
+  INPUT_STATE_COUNT,
+};
+
+struct InputDecoder {
+  // head and tail count bytes and only grow, a byte is at its count modulo
+  // INPUT_RING_SIZE
+  char ring[INPUT_RING_SIZE];
+  uint32_t head, tail;
+
+  enum InputState state;
+  // modifiers of the sequence so far, MOD_ALT after an ESC
+  uint8_t modifiers;
+  unsigned int parameters[INPUT_MAX_PARAMETERS];
+  unsigned int parameter_count;
+  char private_marker;
+  // the UTF-8 character so far and how many continuation bytes it has
+  uint32_t codepoint;
+  unsigned int continuations;
+  // bytes of the character or of an X10 mouse report still to come
+  unsigned int remaining;
+  uint8_t mouse_bytes[3];
+  bool pasting;
+
+  // the ring ran dry in the middle of a sequence at waiting_since
+  bool waiting;
+  int64_t waiting_since;
+};
+
+void init_input_decoder(struct InputDecoder *d);
+// bytes feed_input takes before the ring is full
+unsigned int input_space(struct InputDecoder *d);
+// Copies as many bytes as fit into the ring and returns their number.
+unsigned int feed_input(struct InputDecoder *d, const char *bytes,
+                        unsigned int length);
+// True while bytes wait to be decoded, or a sequence waits to be completed.
+bool input_pending(struct InputDecoder *d);
+// Decodes the next key, false when there is none yet. time (nanoseconds, any
+// monotonic clock) decides when a lone ESC has waited long enough.
+bool next_key_event(struct InputDecoder *d, int64_t time,
+                    struct KeyEvent *event);
+
+// Decodes the UTF-8 character at the start of bytes by the rules keys are
+// decoded with and returns its length. Invalid bytes decode to U+FFFD, a
+// character cut off by the end of bytes has length 0. A NUL byte ends every
+// character, NUL terminated strings may pass any length that reaches the NUL.
+size_t decode_utf8(const char *bytes, size_t length, uint32_t *codepoint);
+
+#endif
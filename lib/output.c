@@ -0,0 +1,185 @@
+#include "output.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define INITIAL_OUTPUT_CAPACITY 1024 * 64
+
+// bytes before output_start were already written by output_drain
+char *output_arena;
+size_t output_start, output_length, output_capacity;
+// totals since the start, for profiling
+uint64_t bytes_written, write_calls;
+int output_fd = STDOUT_FILENO;
+OutputSink output_sink;
+void *output_sink_context;
+OutputSink output_tee_sink;
+void *output_tee_context;
+
+static const char digit_pairs[201] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+void reserve_output(size_t length) {
+  if (output_length + length <= output_capacity) {
+    return;
+  }
+
+  if (output_start > 0) {
+    output_length -= output_start;
+    memmove(output_arena, output_arena + output_start, output_length);
+    output_start = 0;
+    if (output_length + length <= output_capacity) {
+      return;
+    }
+  }
+
+  size_t capacity = output_capacity ? output_capacity : INITIAL_OUTPUT_CAPACITY;
+  while (capacity < output_length + length) {
+    capacity *= 2;
+  }
+
+  char *arena = realloc(output_arena, capacity);
+  if (!arena) {
+    fprintf(stderr, "Could not allocate output buffer.\n");
+    exit(-1);
+  }
+  output_arena = arena;
+  output_capacity = capacity;
+}
+
+void output_bytes(const char *bytes, size_t length) {
+  reserve_output(length);
+  memcpy(output_arena + output_length, bytes, length);
+  output_length += length;
+}
+
+void output_string(const char *string) {
+  if (string) {
+    output_bytes(string, strlen(string));
+  }
+}
+
+void output_char(char c) {
+  reserve_output(1);
+  output_arena[output_length++] = c;
+}
+
+unsigned int format_uint(char *out, unsigned int value) {
+  char digits[10];
+  char *end = digits + sizeof(digits);
+  char *p = end;
+
+  while (value >= 100) {
+    unsigned int pair = (value % 100) * 2;
+    value /= 100;
+    p -= 2;
+    p[0] = digit_pairs[pair];
+    p[1] = digit_pairs[pair + 1];
+  }
+  if (value >= 10) {
+    p -= 2;
+    p[0] = digit_pairs[value * 2];
+    p[1] = digit_pairs[value * 2 + 1];
+  } else {
+    *--p = '0' + value;
+  }
+
+  memcpy(out, p, end - p);
+  return end - p;
+}
+
+void output_uint(unsigned int value) {
+  reserve_output(10);
+  output_length += format_uint(output_arena + output_length, value);
+}
+
+size_t output_pending(void) { return output_length - output_start; }
+
+size_t output_queued(void) {
+  int queued = 0;
+  if (output_sink || ioctl(output_fd, TIOCOUTQ, &queued) != 0 || queued < 0) {
+    return 0;
+  }
+  return queued;
+}
+
+// Writes pending output until done, or until the terminal would block when
+// blocking is false. Returns whether everything was written.
+bool write_output(bool blocking) {
+  if (output_sink && output_start < output_length) {
+    output_sink(output_arena + output_start, output_length - output_start,
+                output_sink_context);
+    if (output_tee_sink) {
+      output_tee_sink(output_arena + output_start,
+                      output_length - output_start, output_tee_context);
+    }
+    write_calls++;
+    bytes_written += output_length - output_start;
+    output_start = output_length;
+  }
+  while (output_start < output_length) {
+    ssize_t result = write(output_fd, output_arena + output_start,
+                           output_length - output_start);
+    write_calls++;
+    if (result >= 0) {
+      if (output_tee_sink) {
+        output_tee_sink(output_arena + output_start, result,
+                        output_tee_context);
+      }
+      output_start += result;
+      bytes_written += result;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      if (!blocking) {
+        return false;
+      }
+      struct pollfd pfd = {output_fd, POLLOUT, 0};
+      poll(&pfd, 1, -1);
+    } else if (errno != EINTR) {
+      break;
+    }
+  }
+  output_start = output_length = 0;
+  return true;
+}
+
+void output_flush(void) { write_output(true); }
+
+bool output_drain(void) { return write_output(false); }
+
+void output_stats(uint64_t *bytes, uint64_t *writes) {
+  *bytes = bytes_written;
+  *writes = write_calls;
+}
+
+void output_to_fd(int fd) {
+  output_fd = fd;
+  output_sink = NULL;
+}
+
+void output_to_sink(OutputSink sink, void *context) {
+  output_sink = sink;
+  output_sink_context = context;
+}
+
+void output_tee(OutputSink tee, void *context) {
+  output_tee_sink = tee;
+  output_tee_context = context;
+}
+
+void free_output(void) {
+  free(output_arena);
+  output_arena = NULL;
+  output_start = output_length = output_capacity = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef output_h
+#define output_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Everything written to the terminal is appended to one growable arena and
+// written out with a single write() by output_flush. output_drain only writes
+// what the terminal takes without blocking and keeps the rest pending.
+
+void output_bytes(const char *bytes, size_t length);
+void output_string(const char *string);
+void output_char(char c);
+void output_uint(unsigned int value);
+// Writes value in decimal to out, which needs room for 10 characters, and
+// returns the number of characters written.
+unsigned int format_uint(char *out, unsigned int value);
+// bytes in the arena that were not written yet
+size_t output_pending(void);
+// bytes the kernel still queues for the terminal (TIOCOUTQ), 0 where it is
+// not reported, e.g. on a pty
+size_t output_queued(void);
+void output_flush(void);
+// Returns true when nothing is pending afterwards.
+bool output_drain(void);
+// bytes written and write() calls made so far
+void output_stats(uint64_t *bytes, uint64_t *writes);
+
+// Output goes to stdout unless it is sent to another file descriptor, e.g. a
+// pty, or handed to a sink. A sink takes everything it is handed, every call
+// counts as one write.
+typedef void (*OutputSink)(const char *bytes, size_t length, void *context);
+void output_to_fd(int fd);
+void output_to_sink(OutputSink sink, void *context);
+// Everything written is also handed to the tee, e.g. to record it. NULL
+// removes it.
+void output_tee(OutputSink tee, void *context);
+void free_output(void);
+
+#endif
@@ -0,0 +1,90 @@
+#include "row_diff.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ROW_DIFF_X86
+#include <immintrin.h>
+#endif
+
+size_t first_difference_scalar(const struct Cell *a, const struct Cell *b,
+                               size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (a[i].codepoint != b[i].codepoint || a[i].style != b[i].style) {
+      return i;
+    }
+  }
+  return count;
+}
+
+#ifdef ROW_DIFF_X86
+
+// Cells are 8 bytes, so the index of the first differing byte in a movemask
+// divided by 8 is the index of the first differing cell.
+
+__attribute__((target("sse2"))) size_t
+first_difference_sse2(const struct Cell *a, const struct Cell *b,
+                      size_t count) {
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(va, vb)) ^ 0xFFFF;
+    if (mask) {
+      return i + __builtin_ctz(mask) / 8;
+    }
+  }
+  return i + first_difference_scalar(a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2"))) size_t
+first_difference_avx2(const struct Cell *a, const struct Cell *b,
+                      size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)(a + i + 4));
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(b + i + 4));
+    __m256i e0 = _mm256_cmpeq_epi64(a0, b0);
+    __m256i e1 = _mm256_cmpeq_epi64(a1, b1);
+    if (!_mm256_testc_si256(_mm256_and_si256(e0, e1), _mm256_set1_epi8(-1))) {
+      uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(e0);
+      if (mask) {
+        return i + __builtin_ctz(mask) / 8;
+      }
+      mask = ~(uint32_t)_mm256_movemask_epi8(e1);
+      return i + 4 + __builtin_ctz(mask) / 8;
+    }
+  }
+  for (; i + 4 <= count; i += 4) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi64(va, vb));
+    if (mask) {
+      return i + __builtin_ctz(mask) / 8;
+    }
+  }
+  return i + first_difference_scalar(a + i, b + i, count - i);
+}
+
+#endif
+
+size_t (*first_difference_implementation)(const struct Cell *,
+                                          const struct Cell *,
+                                          size_t) = first_difference_scalar;
+
+void init_row_diff(void) {
+  first_difference_implementation = first_difference_scalar;
+#ifdef ROW_DIFF_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    first_difference_implementation = first_difference_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    first_difference_implementation = first_difference_sse2;
+  }
+#endif
+}
+
+size_t first_difference(const struct Cell *a, const struct Cell *b,
+                        size_t count) {
+  return first_difference_implementation(a, b, count);
+}
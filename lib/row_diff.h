@@ -0,0 +1,14 @@
+#ifndef row_diff_h
+#define row_diff_h
+#include "cell.h"
+#include <stddef.h>
+
+// Picks the fastest implementation the cpu supports, call once before use.
+void init_row_diff(void);
+
+// Returns the index of the first cell where a and b differ, or count if the
+// first count cells are equal.
+size_t first_difference(const struct Cell *a, const struct Cell *b,
+                        size_t count);
+
+#endif
@@ -0,0 +1,184 @@
+#include "session.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+FILE *recording_file;
+int64_t recording_start;
+uint64_t recorded_tick;
+int64_t recorded_time;
+
+FILE *replay_file;
+uint64_t replayed_tick;
+int64_t replayed_time;
+
+/////////////
+// Varints //
+/////////////
+
+void write_varint(FILE *f, uint64_t value) {
+  while (value >= 0x80) {
+    putc((value & 0x7F) | 0x80, f);
+    value >>= 7;
+  }
+  putc(value, f);
+}
+
+bool read_varint(FILE *f, uint64_t *value) {
+  *value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    int c = getc(f);
+    if (c == EOF) {
+      return false;
+    }
+    *value |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+///////////////
+// Recording //
+///////////////
+
+bool start_recording(const char *path, const struct SessionHeader *header) {
+  recording_file = fopen(path, "wb");
+  if (!recording_file) {
+    return false;
+  }
+  atexit(stop_recording);
+
+  unsigned int term_length = strlen(header->term);
+  fwrite(SESSION_MAGIC, 1, strlen(SESSION_MAGIC), recording_file);
+  write_varint(recording_file, term_length);
+  fwrite(header->term, 1, term_length, recording_file);
+  write_varint(recording_file, header->rows);
+  write_varint(recording_file, header->cols);
+
+  recording_start = now();
+  recorded_tick = 0;
+  recorded_time = 0;
+  return true;
+}
+
+void stop_recording(void) {
+  if (recording_file) {
+    fclose(recording_file);
+    recording_file = NULL;
+  }
+}
+
+// Writes what every record starts with, times are kept in microseconds.
+void record_start(uint64_t tick, enum SessionRecordType type,
+                  unsigned int length) {
+  int64_t time = (now() - recording_start) / NANOSECONDS_PER_MICROSECOND;
+  write_varint(recording_file, tick - recorded_tick);
+  write_varint(recording_file, time - recorded_time);
+  write_varint(recording_file, type | (uint64_t)length << 2);
+  recorded_tick = tick;
+  recorded_time = time;
+}
+
+void record_input(uint64_t tick, const char *bytes, unsigned int length) {
+  if (!recording_file || length == 0) {
+    return;
+  }
+  record_start(tick, SESSION_INPUT, length);
+  fwrite(bytes, 1, length, recording_file);
+}
+
+void record_resize(uint64_t tick, unsigned int rows, unsigned int cols) {
+  if (!recording_file) {
+    return;
+  }
+  record_start(tick, SESSION_RESIZE, 0);
+  write_varint(recording_file, rows);
+  write_varint(recording_file, cols);
+}
+
+void record_ticks(uint64_t tick, uint64_t ticks) {
+  if (!recording_file) {
+    return;
+  }
+  record_start(tick, SESSION_TICKS, 0);
+  write_varint(recording_file, ticks);
+}
+
+///////////////
+// Replaying //
+///////////////
+
+bool start_replay(const char *path, struct SessionHeader *header) {
+  replay_file = fopen(path, "rb");
+  if (!replay_file) {
+    return false;
+  }
+
+  char magic[sizeof(SESSION_MAGIC) - 1];
+  uint64_t term_length, rows, cols;
+  if (fread(magic, 1, sizeof(magic), replay_file) != sizeof(magic) ||
+      memcmp(magic, SESSION_MAGIC, sizeof(magic)) != 0 ||
+      !read_varint(replay_file, &term_length) ||
+      term_length >= SESSION_TERM_SIZE ||
+      fread(header->term, 1, term_length, replay_file) != term_length ||
+      !read_varint(replay_file, &rows) || !read_varint(replay_file, &cols)) {
+    stop_replay();
+    return false;
+  }
+  header->term[term_length] = '\0';
+  header->rows = rows;
+  header->cols = cols;
+
+  replayed_tick = 0;
+  replayed_time = 0;
+  return true;
+}
+
+bool next_session_record(struct SessionRecord *record) {
+  uint64_t ticks, microseconds, type;
+  if (!replay_file || !read_varint(replay_file, &ticks) ||
+      !read_varint(replay_file, &microseconds) ||
+      !read_varint(replay_file, &type)) {
+    return false;
+  }
+  replayed_tick += ticks;
+  replayed_time += microseconds;
+  record->tick = replayed_tick;
+  record->time = replayed_time * NANOSECONDS_PER_MICROSECOND;
+  record->type = type & 3;
+  record->length = 0;
+
+  if (record->type > SESSION_TICKS) {
+    return false;
+  }
+  if (record->type == SESSION_TICKS) {
+    return read_varint(replay_file, &record->ticks);
+  }
+  if (record->type == SESSION_RESIZE) {
+    uint64_t rows, cols;
+    if (!read_varint(replay_file, &rows) || !read_varint(replay_file, &cols)) {
+      return false;
+    }
+    record->rows = rows;
+    record->cols = cols;
+    return true;
+  }
+
+  uint64_t length = type >> 2;
+  if (length > SESSION_INPUT_SIZE ||
+      fread(record->input, 1, length, replay_file) != length) {
+    return false;
+  }
+  record->length = length;
+  return true;
+}
+
+void stop_replay(void) {
+  if (replay_file) {
+    fclose(replay_file);
+    replay_file = NULL;
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef session_h
+#define session_h
+#include <stdbool.h>
+#include <stdint.h>
+
+// Play sessions are recorded into a compact binary log of every chunk of
+// input and every resize, with the game tick it happened in and its time
+// since the recording started. Ticks are run in batches, one per frame event,
+// and a batch of other than one tick is recorded too, since input is handled
+// between batches. Fed back in the same order at the same ticks and in the
+// same batches, the log gives the same game states tick for tick.
+//
+// The log starts with SESSION_MAGIC, the terminfo name and the screen size.
+// Every record follows as unsigned LEB128 varints: the ticks and the
+// microseconds since the previous record, the type with the input length
+// shifted above it, then the input bytes, the rows and columns of a resize,
+// or the ticks of a batch.
+
+#define SESSION_MAGIC "VSR2"
+#define SESSION_TERM_SIZE 64
+// more than the game ever reads at once
+#define SESSION_INPUT_SIZE 4096
+
+struct SessionHeader {
+  char term[SESSION_TERM_SIZE];
+  unsigned int rows, cols;
+};
+
+enum SessionRecordType { SESSION_INPUT, SESSION_RESIZE, SESSION_TICKS };
+
+struct SessionRecord {
+  enum SessionRecordType type;
+  uint64_t tick;
+  // nanoseconds since the recording started
+  int64_t time;
+  char input[SESSION_INPUT_SIZE];
+  unsigned int length;
+  unsigned int rows, cols;
+  // how many ticks the batch that starts at tick runs
+  uint64_t ticks;
+};
+
+// Returns false when the file could not be created. stop_recording, which
+// start_recording registers with atexit, writes out what is buffered. Without
+// a recording, record_input and record_resize return right away.
+bool start_recording(const char *path, const struct SessionHeader *header);
+void stop_recording(void);
+void record_input(uint64_t tick, const char *bytes, unsigned int length);
+void record_resize(uint64_t tick, unsigned int rows, unsigned int cols);
+void record_ticks(uint64_t tick, uint64_t ticks);
+
+// Returns false when the file can not be read or is no session log.
+bool start_replay(const char *path, struct SessionHeader *header);
+// Reads the next record, false at the end of the log or where it is cut off.
+bool next_session_record(struct SessionRecord *record);
+void stop_replay(void);
+
+#endif
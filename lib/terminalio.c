@@ -1,7 +1,22 @@
+// for sem_clockwait
+#define _GNU_SOURCE
 #include "terminalio.h"
+#include "events.h"
+#include "frame_info.h"
+#include "input.h"
+#include "output.h"
+#include "row_diff.h"
+#include "timing.h"
+#include "trace.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -12,19 +27,132 @@
 #include <unibilium.h>
 #include <unistd.h>
 
-#define OUTPUT_BUFFER_SIZE 1024 * 8
+#define FRAME_BUFFER_ALIGNMENT 64
+#define MAX_STYLES 4096
+#define STYLE_INDEX_SIZE (MAX_STYLES * 2)
+#define DEFAULT_STYLE_ID 0
+// layers, the composite and the screen, plus the frames handed to the render
+// thread
+#define FRAME_BUFFER_COUNT (LAYER_COUNT + 2)
+#define FRAME_SLOT_COUNT 3
+// layer_damage and slot_damage
+#define DAMAGE_COUNT (1 + FRAME_SLOT_COUNT)
+// terminfo entry used without a terminal when TERM is not set
+#define HEADLESS_TERM "xterm-256color"
 
 struct winsize winsize;
 
 unsigned int buffer_rows, buffer_cols;
-struct Display **next_frame_buffer, **previous_frame_buffer;
+// Columns [start, end) of a row, empty when start >= end.
+struct Span {
+  unsigned int start, end;
+};
+
+struct FrameBuffer {
+  struct Cell *cells;
+  // what a cell reads as before anything is drawn into it, layers are
+  // transparent there
+  struct Cell blank;
+  // A row only holds what was drawn into it when its epoch matches the
+  // buffer's epoch, otherwise it reads as blank and is wiped on the next draw
+  // into it. Clearing the buffer is a single epoch increment.
+  uint32_t epoch;
+  uint32_t *row_epochs;
+  // per row, the columns drawn into since the row was last wiped. Everything
+  // outside of it is blank.
+  struct Span *drawn;
+  // bit y is set when row y was drawn into, possibly in an older epoch
+  uint64_t *drawn_rows;
+};
+
+// per row, the columns that have to be looked at again
+struct Damage {
+  struct Span *spans;
+  uint64_t *rows;
+};
+
+// All frame buffers live in one allocation, cell (x, y) is at y * cols + x.
+//
+// Drawing goes into the selected layer. The entities layer is cleared after
+// every frame, the other layers keep their content until clear_layer. Every
+// change to a layer is recorded as damage, and render_frame recomputes the
+// composite of all layers in next_frame_buffer and diffs it against
+// previous_frame_buffer (what the terminal shows) only inside damaged spans.
+//
+// With a render thread, render_frame copies the composite into one of three
+// frame slots instead, and the render thread diffs the newest one against
+// previous_frame_buffer inside the damage published with it.
+struct Cell *frame_buffers;
+size_t frame_buffer_capacity;
+unsigned int frame_buffer_count = FRAME_BUFFER_COUNT;
+struct Span *drawn_spans;
+uint32_t *row_epochs;
+uint64_t *drawn_rows;
+unsigned int drawn_rows_capacity;
+// scratch space for scroll detection
+uint64_t *row_hashes;
+int *row_hash_index;
+struct FrameBuffer layers[LAYER_COUNT];
+enum Layer selected_layer = LAYER_ENTITIES;
+struct FrameBuffer next_frame_buffer, previous_frame_buffer;
+struct FrameBuffer frame_slots[FRAME_SLOT_COUNT];
+// the columns whose composite has to be recomputed, and per frame slot those
+// the render thread has to diff
+struct Damage layer_damage, slot_damage[FRAME_SLOT_COUNT];
+bool buffers_resized;
+// what render_frame puts on the screen and where it has to diff
+struct FrameBuffer *target_frame = &next_frame_buffer;
+struct Damage *target_damage = &layer_damage;
 unsigned int screen_size_rows, screen_size_cols;
 unibi_term *ut;
 
-void append_char(char *string, char c) {
-  unsigned int l = strlen(string);
-  string[l] = c;
-  string[l + 1] = '\0';
+// cursor movements the terminal advertises in its terminfo entry
+struct MovementCapabilities {
+  bool cursor_home, carriage_return, line_feed, backspace;
+  bool parm_right, parm_left, parm_up, parm_down;
+  bool column_address, row_address;
+} movement;
+
+// erase and repeat sequences the terminal advertises
+struct EraseCapabilities {
+  bool clr_eol, clr_eos, erase_chars, repeat_char;
+} erase;
+
+// scroll region and scrolling sequences the terminal advertises
+struct ScrollCapabilities {
+  bool change_scroll_region, parm_index, parm_rindex;
+} scrolling;
+
+bool load_terminal_capabilities(const char *term) {
+  ut = unibi_from_term(term);
+  if (!ut) {
+    fprintf(stderr, "Could not load terminfo for terminal '%s'\n", term);
+    return false;
+  }
+
+  const char *line_feed = unibi_get_str(ut, unibi_cursor_down);
+  const char *backspace = unibi_get_str(ut, unibi_cursor_left);
+  movement.cursor_home = unibi_get_str(ut, unibi_cursor_home) != NULL;
+  movement.carriage_return = unibi_get_str(ut, unibi_carriage_return) != NULL;
+  movement.line_feed = line_feed && strcmp(line_feed, "\n") == 0;
+  movement.backspace = backspace && strcmp(backspace, "\b") == 0;
+  movement.parm_right = unibi_get_str(ut, unibi_parm_right_cursor) != NULL;
+  movement.parm_left = unibi_get_str(ut, unibi_parm_left_cursor) != NULL;
+  movement.parm_up = unibi_get_str(ut, unibi_parm_up_cursor) != NULL;
+  movement.parm_down = unibi_get_str(ut, unibi_parm_down_cursor) != NULL;
+  movement.column_address = unibi_get_str(ut, unibi_column_address) != NULL;
+  movement.row_address = unibi_get_str(ut, unibi_row_address) != NULL;
+
+  erase.clr_eol = unibi_get_str(ut, unibi_clr_eol) != NULL;
+  erase.clr_eos = unibi_get_str(ut, unibi_clr_eos) != NULL;
+  erase.erase_chars = unibi_get_str(ut, unibi_erase_chars) != NULL;
+  erase.repeat_char = unibi_get_str(ut, unibi_repeat_char) != NULL;
+
+  scrolling.change_scroll_region =
+      unibi_get_str(ut, unibi_change_scroll_region) != NULL;
+  scrolling.parm_index = unibi_get_str(ut, unibi_parm_index) != NULL;
+  scrolling.parm_rindex = unibi_get_str(ut, unibi_parm_rindex) != NULL;
+  return true;
 }
 
 bool check_terminal_capabilities(void) {
@@ -33,10 +161,7 @@ bool check_terminal_capabilities(void) {
     fprintf(stderr, "TERM not set in environment.\n");
     return false;
   }
-
-  ut = unibi_from_term(term);
-  if (!ut) {
-    fprintf(stderr, "Could not load terminfo for terminal '%s'\n", term);
+  if (!load_terminal_capabilities(term)) {
     return false;
   }
 
@@ -49,44 +174,66 @@ bool check_terminal_capabilities(void) {
   return true;
 }
 
+// without a terminal the size only changes through resize_headless
+bool headless;
+
 void set_screen_size(void) {
+  if (headless) {
+    return;
+  }
   ioctl(STDOUT_FILENO, TIOCGWINSZ, &winsize);
   screen_size_rows = winsize.ws_row;
   screen_size_cols = winsize.ws_col;
 }
 
-void resize_signal(int signal) { set_screen_size(); }
-
 ////////////////////////////
 // Terminal Configuration //
 ////////////////////////////
 
-char output_buffer[OUTPUT_BUFFER_SIZE];
-struct termios original_termios;
-int flags;
-
-void set_output_buffer(void) {
-  setvbuf(stdout, output_buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
-}
+// Pasted text comes between ESC[200~ and ESC[201~, so that it is not taken
+// for typed keys. terminfo has no standard capability for it, terminals that
+// do not know the mode ignore it.
+#define BRACKETED_PASTE_ON "\033[?2004h"
+#define BRACKETED_PASTE_OFF "\033[?2004l"
 
-void set_blocking_input(void) {
-  fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
+struct termios original_termios;
+// Frames are written through a file description of their own, the only one
+// that is non-blocking. On a terminal stdin, stdout and stderr share one,
+// O_NONBLOCK there would make diagnostics on stderr fail with EAGAIN while
+// output is backed up.
+int terminal_output_fd = -1;
+
+// Opens the terminal on stdout again for frames, where stdout is no terminal
+// frames go to stdout and writing them blocks.
+void open_terminal_output(void) {
+  const char *name = isatty(STDOUT_FILENO) ? ttyname(STDOUT_FILENO) : NULL;
+  if (name) {
+    terminal_output_fd = open(name, O_WRONLY | O_NOCTTY | O_NONBLOCK);
+  }
+  if (terminal_output_fd >= 0) {
+    output_to_fd(terminal_output_fd);
+  }
 }
 
-void set_non_blocking_input(void) {
-  fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+void close_terminal_output(void) {
+  if (terminal_output_fd >= 0) {
+    output_to_fd(STDOUT_FILENO);
+    close(terminal_output_fd);
+    terminal_output_fd = -1;
+  }
 }
 
 void restore_terminal(void) {
 
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_termios);
-  set_blocking_input();
 
-  fputs(unibi_get_str(ut, unibi_exit_ca_mode), stdout);
-  fputs(unibi_get_str(ut, unibi_cursor_normal), stdout);
+  output_string(BRACKETED_PASTE_OFF);
+  output_string(unibi_get_str(ut, unibi_exit_ca_mode));
+  output_string(unibi_get_str(ut, unibi_cursor_normal));
 
   fprintf(stderr, "END");
-  fflush(stdout);
+  output_flush();
+  close_terminal_output();
 }
 
 void restore_terminal_on_signal(int sig) {
@@ -97,7 +244,6 @@ void restore_terminal_on_signal(int sig) {
 
 void configure_terminal(void) {
   tcgetattr(STDIN_FILENO, &original_termios);
-  flags = fcntl(STDIN_FILENO, F_GETFL, 0);
 
   atexit(restore_terminal);
   signal(SIGSEGV, restore_terminal_on_signal);
@@ -110,38 +256,34 @@ void configure_terminal(void) {
   changed.c_cc[VTIME] = 0;
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &changed);
 
-  set_non_blocking_input();
-  set_output_buffer();
+  // frames are only written as far as the terminal keeps up, see
+  // output_behind
+  open_terminal_output();
 
-  fputs(unibi_get_str(ut, unibi_enter_ca_mode), stdout);
-  fputs(unibi_get_str(ut, unibi_cursor_invisible), stdout);
+  output_string(unibi_get_str(ut, unibi_enter_ca_mode));
+  output_string(unibi_get_str(ut, unibi_cursor_invisible));
+  output_string(BRACKETED_PASTE_ON);
 
-  fflush(stdout);
+  output_flush();
 }
 
 ////////////
 // Colors //
 ////////////
 
-bool color_equal(struct Color *a, struct Color *b) {
-  if (a->type != b->type) {
-    return false;
-  }
-
-  if (a->type == DEFAULT) {
-    return true;
-  }
-
-  if ((a->type == _8 || a->type == _256) && a->color == b->color) {
-    return true;
-  }
-
-  if (a->type == TRUE && a->red == b->red && a->green == b->green &&
-      a->blue == b->blue) {
-    return true;
+// Packs a color into one comparable word: the type in the top byte and the
+// color index or rgb value below it. Unused fields never end up in the key.
+uint32_t color_key(struct Color *c) {
+  switch (c->type) {
+  case _8:
+  case _256:
+    return (uint32_t)c->type << 24 | c->color;
+  case TRUE:
+    return (uint32_t)c->type << 24 | (uint32_t)c->red << 16 |
+           (uint32_t)c->green << 8 | c->blue;
+  default:
+    return (uint32_t)DEFAULT << 24;
   }
-
-  return false;
 }
 
 struct Color color_rgb(uint8_t r, uint8_t g, uint8_t b) {
@@ -167,6 +309,13 @@ int min(int a, int b) {
     return b;
 }
 
+int max(int a, int b) {
+  if (a > b)
+    return a;
+  else
+    return b;
+}
+
 struct Color color_256_rgb(uint8_t r, uint8_t g, uint8_t b) {
   struct Color c;
   c.type = _256;
@@ -201,10 +350,6 @@ void log_color(struct Color c) {
 // Styles //
 ////////////
 
-int qsort_output_mode_compare(const void *a, const void *b) {
-  return (*(enum OutputMode *)a - *(enum OutputMode *)b);
-}
-
 char unset_mode(enum OutputMode mode) {
   if (mode == BOLD) {
     return 22;
@@ -229,34 +374,11 @@ bool valid_mode(enum OutputMode mode) {
   }
 }
 
-struct ModesList empty_modes_list(void) {
-  struct ModesList ml;
-  ml.count = 0;
-  return ml;
-}
-
-bool modes_equal(struct ModesList *a, struct ModesList *b) {
-  if (a->count != b->count)
-    return false;
-
-  for (unsigned int i = 0; i < a->count; i++) {
-    if (a->modes[i] != b->modes[i])
-      return false;
-  }
-  return true;
-}
-
-bool style_equal(struct Style *a, struct Style *b) {
-  return (color_equal(&a->color, &b->color) &&
-          color_equal(&a->background, &b->background) &&
-          modes_equal(&a->modes_list, &b->modes_list));
-}
-
 struct Style default_style(void) {
   struct Style s;
   s.color = default_color();
   s.background = default_color();
-  s.modes_list = empty_modes_list();
+  s.modes = 0;
   return s;
 }
 
@@ -264,64 +386,21 @@ struct Style color_style(struct Color color, struct Color background) {
   struct Style s;
   s.color = color;
   s.background = background;
-  s.modes_list = empty_modes_list();
+  s.modes = 0;
   return s;
 }
 
-struct ModesList modes_list(unsigned int modes_count, va_list args) {
-  struct ModesList ml;
-  ml.count = 0;
+uint16_t modes_mask(unsigned int modes_count, va_list args) {
+  uint16_t modes = 0;
 
   for (uint8_t i = 0; i < modes_count; i++) {
     enum OutputMode mode = va_arg(args, int);
 
     if (valid_mode(mode)) {
-      bool duplicate = false;
-      for (uint8_t x = 0; x < ml.count; x++) {
-        if (ml.modes[x] == mode) {
-          duplicate = true;
-        }
-      }
-
-      if (!duplicate) {
-        ml.modes[ml.count] = mode;
-        ml.count++;
-      }
-    }
-  }
-  qsort(ml.modes, ml.count, sizeof(enum OutputMode), qsort_output_mode_compare);
-  return ml;
-}
-
-void remove_mode(struct ModesList *ml, unsigned int index) {
-  ml->count--;
-  for (unsigned int i = index; i < ml->count; i++) {
-    ml->modes[i] = ml->modes[i + 1];
-  }
-}
-
-void add_mode(struct ModesList *ml, enum OutputMode mode) {
-  ml->modes[ml->count] = mode;
-  ml->count++;
-}
-
-void modes_string(char *string, struct ModesList *ml, bool set) {
-  string[0] = '\0';
-  for (unsigned int i = 0; i < ml->count; i++) {
-    char tmp[3];
-
-    if (set) {
-      sprintf(tmp, "%d", ml->modes[i]);
-    } else {
-      sprintf(tmp, "%d", unset_mode(ml->modes[i]));
-    }
-
-    strcat(string, tmp);
-
-    if (!(i == ml->count - 1)) {
-      append_char(string, ';');
+      modes |= MODE_BIT(mode);
     }
   }
+  return modes;
 }
 
 struct Style full_style(struct Color color, struct Color background,
@@ -332,7 +411,7 @@ struct Style full_style(struct Color color, struct Color background,
 
   va_list args;
   va_start(args, modes_count);
-  s.modes_list = modes_list(modes_count, args);
+  s.modes = modes_mask(modes_count, args);
   va_end(args);
 
   return s;
@@ -341,294 +420,1546 @@ struct Style full_style(struct Color color, struct Color background,
 void change_modes(struct Style *s, unsigned int modes_count, ...) {
   va_list args;
   va_start(args, modes_count);
-  s->modes_list = modes_list(modes_count, args);
+  s->modes = modes_mask(modes_count, args);
   va_end(args);
 }
+
+/////////////////////
+// Style Interning //
+/////////////////////
+
+// Every style that reaches the frame buffer is stored once in this table and
+// referred to by its index. Id 0 is always the default style.
+struct InternedStyle {
+  struct Style style;
+  uint32_t color_key, background_key;
+};
+
+struct InternedStyle styles[MAX_STYLES];
+uint32_t styles_count;
+// styles drawn in the default style because the table was full
+unsigned int styles_overflowed;
+// open addressing hash index into styles, holds id + 1 (0 marks a free slot)
+uint16_t style_index[STYLE_INDEX_SIZE];
+
+uint32_t style_hash(uint32_t color_key, uint32_t background_key,
+                    uint16_t modes) {
+  uint32_t h = color_key * 0x9E3779B1u;
+  h ^= background_key + 0x7F4A7C15u + (h << 6) + (h >> 2);
+  h ^= modes * 0x85EBCA77u;
+  return h ^ (h >> 15);
+}
+
+uint32_t intern_style(struct Style *s) {
+  uint32_t color = color_key(&s->color);
+  uint32_t background = color_key(&s->background);
+  uint16_t modes = s->modes & MODES_MASK;
+
+  uint32_t slot = style_hash(color, background, modes) % STYLE_INDEX_SIZE;
+  while (style_index[slot] != 0) {
+    struct InternedStyle *is = &styles[style_index[slot] - 1];
+    if (is->color_key == color && is->background_key == background &&
+        is->style.modes == modes) {
+      return style_index[slot] - 1;
+    }
+    slot = (slot + 1) % STYLE_INDEX_SIZE;
+  }
+
+  if (styles_count == MAX_STYLES) {
+    if (styles_overflowed++ == 0) {
+      trace_instant("style table full", now());
+    }
+    return DEFAULT_STYLE_ID;
+  }
+
+  struct InternedStyle *is = &styles[styles_count];
+  is->style = *s;
+  is->style.modes = modes;
+  is->color_key = color;
+  is->background_key = background;
+  style_index[slot] = ++styles_count;
+  return styles_count - 1;
+}
+
+// Called after the terminal was restored, where the message can be read.
+void report_style_overflow(void) {
+  if (styles_overflowed > 0) {
+    fprintf(stderr,
+            "The style table was full, %u times a style was drawn in the "
+            "default style instead.\n",
+            styles_overflowed);
+  }
+}
+
+unsigned int style_overflows(void) { return styles_overflowed; }
+
+void init_styles(void) {
+  struct Style s = default_style();
+  styles_count = 0;
+  styles_overflowed = 0;
+  memset(style_index, 0, sizeof(style_index));
+  intern_style(&s);
+}
+
 /////////////
 // Display //
 /////////////
-bool display_equal(struct Display *a, struct Display *b) {
-  return (strcmp(a->character, b->character) == 0 &&
-          style_equal(&a->style, &b->style));
+
+// Decodes a NUL terminated UTF-8 string into at most max cells of one style
+// and returns how many were written.
+unsigned int rasterize_text(const char *string, uint32_t style,
+                            struct Cell *cells, unsigned int max) {
+  unsigned int count = 0;
+  while (*string && count < max) {
+    string += decode_utf8(string, SIZE_MAX, &cells[count].codepoint);
+    cells[count].style = style;
+    count++;
+  }
+  return count;
+}
+
+unsigned int encode_utf8(uint32_t codepoint, char *out) {
+  if (codepoint < 0x80) {
+    out[0] = codepoint;
+    return 1;
+  }
+  if (codepoint < 0x800) {
+    out[0] = 0xC0 | codepoint >> 6;
+    out[1] = 0x80 | (codepoint & 0x3F);
+    return 2;
+  }
+  if (codepoint < 0x10000) {
+    out[0] = 0xE0 | codepoint >> 12;
+    out[1] = 0x80 | (codepoint >> 6 & 0x3F);
+    out[2] = 0x80 | (codepoint & 0x3F);
+    return 3;
+  }
+  out[0] = 0xF0 | codepoint >> 18;
+  out[1] = 0x80 | (codepoint >> 12 & 0x3F);
+  out[2] = 0x80 | (codepoint >> 6 & 0x3F);
+  out[3] = 0x80 | (codepoint & 0x3F);
+  return 4;
+}
+
+struct Cell display_cell(struct Display *d) {
+  struct Cell c;
+  // 0 would be a transparent cell, an empty character draws U+FFFD instead
+  decode_utf8(d->character, sizeof(d->character), &c.codepoint);
+  c.codepoint = d->character[0] == '\0' ? 0xFFFD : c.codepoint;
+  c.style = intern_style(&d->style);
+  return c;
+}
+
+bool cell_equal(struct Cell a, struct Cell b) {
+  return a.codepoint == b.codepoint && a.style == b.style;
+}
+
+struct Cell empty_cell(void) {
+  struct Cell c = {' ', DEFAULT_STYLE_ID};
+  return c;
+}
+
+// layer cells nothing was drawn into, the layers below show through
+struct Cell transparent_cell(void) {
+  struct Cell c = {0, DEFAULT_STYLE_ID};
+  return c;
+}
+
+bool blank_cell(struct Cell c) {
+  return c.codepoint == ' ' && c.style == DEFAULT_STYLE_ID;
 }
 
 ///////////////////////////
 // Terminal Interactions //
 ///////////////////////////
 
-struct Style current_style;
+uint32_t current_style;
 
+// cursor_x == buffer_cols after writing the last column, the position is then
+// unknown until the next absolute move
 unsigned int cursor_y;
 unsigned int cursor_x;
 
-void clear_screen(void) {
-  fputs(unibi_get_str(ut, unibi_clear_screen), stdout);
-  cursor_x = 0;
-  cursor_y = 0;
-}
+// what the renderer did since the last profiled frame
+struct RenderCounters render_counters;
 
-void move_cursor(unsigned int x, unsigned int y) {
-  if (x == cursor_x && y == cursor_y) {
-    return;
-  }
-  // TODO: use unibilium string here? or is the ansi standard good enough?
-  printf("\033[%d;%dH", y + 1, x + 1);
+void reset_display_modes(void) { output_bytes("\033[0m", 4); }
 
-  cursor_x = x;
-  cursor_y = y;
+//////////////////////////
+// SGR Transition Cache //
+//////////////////////////
+
+// The escape sequence for every (from, to) style transition is built once and
+// kept in a small set associative cache with LRU replacement, a hit is a
+// single copy into the output.
+
+#define SGR_MAX_LENGTH 96
+#define SGR_CACHE_SETS 64
+#define SGR_CACHE_WAYS 4
+
+struct Sgr {
+  uint8_t length;
+  char bytes[SGR_MAX_LENGTH];
+};
+
+struct SgrCacheEntry {
+  uint32_t from, to;
+  uint32_t last_used; // 0 marks an empty entry
+  struct Sgr sgr;
+};
+
+struct SgrCacheEntry sgr_cache[SGR_CACHE_SETS][SGR_CACHE_WAYS];
+uint32_t sgr_cache_clock;
+
+void sgr_bytes(struct Sgr *sgr, const char *bytes, unsigned int length) {
+  memcpy(sgr->bytes + sgr->length, bytes, length);
+  sgr->length += length;
 }
 
-void reset_display_modes(void) { printf("\033[0m"); }
+void sgr_uint(struct Sgr *sgr, unsigned int value) {
+  sgr->length += format_uint(sgr->bytes + sgr->length, value);
+}
+
+// separates a parameter from the previous one, unless it is the first
+void sgr_parameter(struct Sgr *sgr) {
+  if (sgr->length > 2) {
+    sgr->bytes[sgr->length++] = ';';
+  }
+}
 
-void color_string(char *string, struct Color *c, bool background) {
+void sgr_color(struct Sgr *sgr, struct Color *c, bool background) {
+  sgr_parameter(sgr);
   switch (c->type) {
   case DEFAULT:
-    if (background) {
-      sprintf(string, "49");
-    } else {
-      sprintf(string, "39");
-    }
+    sgr_bytes(sgr, background ? "49" : "39", 2);
     break;
-
   case _8:
-    if (background) {
-      sprintf(string, "%d", c->color + 40);
-    } else {
-      sprintf(string, "%d", c->color + 30);
-    }
+    sgr_uint(sgr, c->color + (background ? 40 : 30));
     break;
   case _256:
-    if (background) {
-      sprintf(string, "48;5;%d", c->color + 40);
-    } else {
-      sprintf(string, "38;5;%d", c->color + 30);
-    }
+    sgr_bytes(sgr, background ? "48;5;" : "38;5;", 5);
+    sgr_uint(sgr, c->color);
     break;
   case TRUE:
-    if (background) {
-      sprintf(string, "48:2:%d:%d:%d", c->red, c->green, c->blue);
-    } else {
-      sprintf(string, "38:2:%d:%d:%d", c->red, c->green, c->blue);
-    }
+    sgr_bytes(sgr, background ? "48:2:" : "38:2:", 5);
+    sgr_uint(sgr, c->red);
+    sgr_bytes(sgr, ":", 1);
+    sgr_uint(sgr, c->green);
+    sgr_bytes(sgr, ":", 1);
+    sgr_uint(sgr, c->blue);
     break;
   }
 }
 
-void set_style(struct Style s) {
-  if (style_equal(&current_style, &s)) {
-    return;
+// appends the set (or unset) codes of all modes in the mask
+void sgr_modes(struct Sgr *sgr, uint16_t modes, bool set) {
+  for (enum OutputMode mode = BOLD; mode <= STRIKETHROUGH; mode++) {
+    if (modes & MODE_BIT(mode)) {
+      sgr_parameter(sgr);
+      sgr_uint(sgr, set ? mode : (unsigned int)unset_mode(mode));
+    }
+  }
+}
+
+// only changes what differs between the two styles
+void sgr_delta(struct Sgr *sgr, struct InternedStyle *from,
+               struct InternedStyle *to) {
+  sgr->length = 0;
+  sgr_bytes(sgr, "\033[", 2);
+
+  if (from->color_key != to->color_key) {
+    sgr_color(sgr, &to->style.color, false);
   }
-  char output_string[200] = "";
-  if (!color_equal(&current_style.color, &s.color)) {
-    char new_color_string[40];
-    color_string(new_color_string, &s.color, false);
-    strcat(output_string, new_color_string);
+  if (from->background_key != to->background_key) {
+    sgr_color(sgr, &to->style.background, true);
   }
 
-  if (!color_equal(&current_style.background, &s.background)) {
-    char new_color_string[40];
-    color_string(new_color_string, &s.background, true);
-    if (strlen(output_string) > 0) {
-      append_char(output_string, ';');
-    }
-    strcat(output_string, new_color_string);
+  uint16_t unset_modes = from->style.modes & ~to->style.modes;
+  uint16_t set_modes = to->style.modes & ~from->style.modes;
+  // bold and dim share one reset code, unsetting one clears both
+  if (unset_modes & (MODE_BIT(BOLD) | MODE_BIT(DIM))) {
+    unset_modes &= ~MODE_BIT(DIM);
+    unset_modes |= MODE_BIT(BOLD);
+    set_modes |= to->style.modes & (MODE_BIT(BOLD) | MODE_BIT(DIM));
   }
 
-  if (!modes_equal(&current_style.modes_list, &s.modes_list)) {
-    struct ModesList old_modes = current_style.modes_list;
-    struct ModesList new_modes = empty_modes_list();
+  sgr_modes(sgr, unset_modes, false);
+  sgr_modes(sgr, set_modes, true);
+  sgr_bytes(sgr, "m", 1);
+}
 
-    for (uint8_t i = 0; i < s.modes_list.count; i++) {
-      bool mode_already_set = false;
-      for (uint8_t j = 0; j < old_modes.count; j++) {
-        if (s.modes_list.modes[i] == old_modes.modes[j]) {
-          remove_mode(&old_modes, j);
-          mode_already_set = true;
-          break;
-        }
-      }
+// resets everything and sets the style from scratch
+void sgr_reset(struct Sgr *sgr, struct InternedStyle *to) {
+  sgr->length = 0;
+  sgr_bytes(sgr, "\033[0", 3);
 
-      if (!mode_already_set) {
-        add_mode(&new_modes, s.modes_list.modes[i]);
-      }
-    }
+  if (to->style.color.type != DEFAULT) {
+    sgr_color(sgr, &to->style.color, false);
+  }
+  if (to->style.background.type != DEFAULT) {
+    sgr_color(sgr, &to->style.background, true);
+  }
+  sgr_modes(sgr, to->style.modes, true);
+  sgr_bytes(sgr, "m", 1);
+}
 
-    char output_modes_string[20];
+struct Sgr *sgr_transition(uint32_t from, uint32_t to) {
+  struct SgrCacheEntry *set = sgr_cache[(from * 31 + to) % SGR_CACHE_SETS];
+  struct SgrCacheEntry *victim = &set[0];
+  sgr_cache_clock++;
 
-    if (new_modes.count > 0) {
-      if (strlen(output_string) > 0) {
-        append_char(output_string, ';');
-      }
-      modes_string(output_modes_string, &new_modes, true);
-      strcat(output_string, output_modes_string);
+  for (unsigned int way = 0; way < SGR_CACHE_WAYS; way++) {
+    struct SgrCacheEntry *entry = &set[way];
+    if (entry->last_used != 0 && entry->from == from && entry->to == to) {
+      entry->last_used = sgr_cache_clock;
+      return &entry->sgr;
     }
-
-    if (old_modes.count > 0) {
-      if (strlen(output_string) > 0) {
-        append_char(output_string, ';');
-      }
-      modes_string(output_modes_string, &old_modes, false);
-      strcat(output_string, output_modes_string);
+    if (entry->last_used < victim->last_used) {
+      victim = entry;
     }
   }
 
-  printf("\033[%sm", output_string);
+  struct Sgr reset;
+  sgr_delta(&victim->sgr, &styles[from], &styles[to]);
+  sgr_reset(&reset, &styles[to]);
+  if (reset.length < victim->sgr.length) {
+    victim->sgr = reset;
+  }
+  victim->from = from;
+  victim->to = to;
+  victim->last_used = sgr_cache_clock;
+  return &victim->sgr;
+}
+
+void clear_sgr_cache(void) {
+  memset(sgr_cache, 0, sizeof(sgr_cache));
+  sgr_cache_clock = 0;
+}
+
+void set_style(uint32_t id) {
+  if (current_style == id) {
+    return;
+  }
+
+  struct Sgr *sgr = sgr_transition(current_style, id);
+  output_bytes(sgr->bytes, sgr->length);
+  render_counters.sgr_changes++;
 
-  current_style = s;
+  current_style = id;
+}
+
+// Clearing uses the current background like every erase, so it is done in the
+// default style.
+void clear_screen(void) {
+  set_style(DEFAULT_STYLE_ID);
+  output_string(unibi_get_str(ut, unibi_clear_screen));
+  cursor_x = 0;
+  cursor_y = 0;
 }
 
 /////////////////////////////
 // Frame Buffer Management //
 /////////////////////////////
 
-void switch_frame_buffers(void) {
-  struct Display **temp = previous_frame_buffer;
-  previous_frame_buffer = next_frame_buffer;
-  next_frame_buffer = temp;
-}
+unsigned int bitmap_words(unsigned int bits) { return (bits + 63) / 64; }
 
-void clear_frame_buffer(struct Display **buffer, unsigned int rows,
+void reset_frame_buffer(struct FrameBuffer *buffer, unsigned int rows,
                         unsigned int cols) {
-  struct Display empty = {" ", default_style()};
+  size_t size = (size_t)rows * cols;
+  for (size_t i = 0; i < size; i++) {
+    buffer->cells[i] = buffer->blank;
+  }
   for (unsigned int row = 0; row < rows; row++) {
-    for (unsigned int col = 0; col < cols; col++) {
-      buffer[row][col] = empty;
-    }
+    buffer->drawn[row].start = cols;
+    buffer->drawn[row].end = 0;
+    buffer->row_epochs[row] = 0;
   }
+  buffer->epoch = 1;
+  memset(buffer->drawn_rows, 0, bitmap_words(rows) * sizeof(uint64_t));
 }
 
-struct Display **init_frame_buffer(unsigned int rows, unsigned int cols) {
-  struct Display **buffer = malloc(rows * sizeof(struct Display *));
-  for (unsigned int i = 0; i < rows; i++) {
-    buffer[i] = malloc(cols * sizeof(struct Display));
-  }
+void clear_frame_buffer(struct FrameBuffer *buffer) { buffer->epoch++; }
 
-  clear_frame_buffer(buffer, rows, cols);
-  return buffer;
+bool row_live(struct FrameBuffer *buffer, unsigned int y) {
+  return buffer->row_epochs[y] == buffer->epoch;
 }
 
-void free_frame_buffer(struct Display **buffer, unsigned int rows) {
-  for (unsigned int i = 0; i < rows; i++) {
-    free(buffer[i]);
+// Wipes what a stale row still holds from an older epoch, afterwards the row
+// can be drawn into.
+void revive_row(struct FrameBuffer *buffer, unsigned int y) {
+  if (row_live(buffer, y)) {
+    return;
   }
 
-  free(buffer);
+  struct Span *span = &buffer->drawn[y];
+  struct Cell *row = buffer->cells + y * buffer_cols;
+  for (unsigned int x = span->start; x < span->end; x++) {
+    row[x] = buffer->blank;
+  }
+  span->start = buffer_cols;
+  span->end = 0;
+  buffer->row_epochs[y] = buffer->epoch;
 }
 
-// void resize_frame_buffer(struct Display **buffer, unsigned int current_rows,
-//                          unsigned int current_cols, unsigned int
-//                          change_rows_to, unsigned int change_cols_to) {
-//
-//   if (change_rows_to < current_rows) {
-//     for (unsigned int i = change_rows_to - 1; i < current_rows; i++) {
-//       free(buffer[i]);
-//     }
-//   }
-//
-//   if (change_rows_to != current_rows) {
-//     buffer = realloc(buffer, change_rows_to * sizeof(struct Display *));
-//   };
-//
-//   if (change_rows_to > current_rows) {
-//     for (unsigned int i = current_rows - 1; i < change_rows_to; i++) {
-//       buffer[i] = malloc(change_cols_to * sizeof(struct Display));
-//     }
-//   }
-//
-//   if (change_cols_to != current_cols) {
-//     for (unsigned int i = 0; i < change_rows_to; i++) {
-//       buffer[i] = realloc(buffer[i], change_cols_to * sizeof(struct
-//       Display));
-//     }
-//   }
-// }
-
-void free_frame_buffers(void) {
-  free_frame_buffer(previous_frame_buffer, buffer_rows);
-  free_frame_buffer(next_frame_buffer, buffer_rows);
+// Makes a row read as blank without touching its cells.
+void expire_row(struct FrameBuffer *buffer, unsigned int y) {
+  buffer->row_epochs[y] = buffer->epoch - 1;
+  buffer->drawn_rows[y / 64] &= ~((uint64_t)1 << (y % 64));
 }
 
-void init_frame_buffers(unsigned int rows, unsigned int cols) {
-  previous_frame_buffer = init_frame_buffer(rows, cols);
-  next_frame_buffer = init_frame_buffer(rows, cols);
-  buffer_rows = rows;
-  buffer_cols = cols;
-
-  atexit(free_frame_buffers);
+void mark_drawn(struct FrameBuffer *buffer, unsigned int y, unsigned int start,
+                unsigned int end) {
+  struct Span *span = &buffer->drawn[y];
+  if (start < span->start) {
+    span->start = start;
+  }
+  if (end > span->end) {
+    span->end = end;
+  }
+  buffer->drawn_rows[y / 64] |= (uint64_t)1 << (y % 64);
 }
 
-void resize_frame_buffers(unsigned int rows, unsigned int cols) {
-  if (rows == buffer_rows && cols == buffer_cols) {
+void add_damage(struct Damage *damage, unsigned int y, unsigned int start,
+                unsigned int end) {
+  if (start >= end) {
     return;
   }
+  if (start < damage->spans[y].start) {
+    damage->spans[y].start = start;
+  }
+  if (end > damage->spans[y].end) {
+    damage->spans[y].end = end;
+  }
+  damage->rows[y / 64] |= (uint64_t)1 << (y % 64);
+}
 
-  free_frame_buffers();
-  init_frame_buffers(rows, cols);
-  clear_screen();
+void clear_damage(struct Damage *damage) {
+  for (unsigned int word = 0; word < bitmap_words(buffer_rows); word++) {
+    uint64_t rows = damage->rows[word];
+    while (rows) {
+      unsigned int row = word * 64 + __builtin_ctzll(rows);
+      rows &= rows - 1;
+      damage->spans[row].start = buffer_cols;
+      damage->spans[row].end = 0;
+    }
+    damage->rows[word] = 0;
+  }
 }
 
-///////////////////////
-// Render Functions ///
-///////////////////////
+// Clears a layer, everything it showed is damaged.
+void clear_layer_buffer(struct FrameBuffer *layer) {
+  for (unsigned int word = 0; word < bitmap_words(buffer_rows); word++) {
+    uint64_t rows = layer->drawn_rows[word];
+    while (rows) {
+      unsigned int row = word * 64 + __builtin_ctzll(rows);
+      rows &= rows - 1;
+      if (row_live(layer, row)) {
+        add_damage(&layer_damage, row, layer->drawn[row].start,
+                   layer->drawn[row].end);
+      }
+    }
+    layer->drawn_rows[word] = 0;
+  }
+  clear_frame_buffer(layer);
+}
 
-void render_display(unsigned int x, unsigned int y, struct Display d) {
-  move_cursor(x, y);
-  set_style(d.style);
-  printf("%s", d.character);
-  cursor_x++;
+// Records that [start, end) of row y was drawn into the layer and returns the
+// row, which has to be written after this call.
+struct Cell *draw_into_layer(struct FrameBuffer *layer, unsigned int y,
+                             unsigned int start, unsigned int end) {
+  revive_row(layer, y);
+  mark_drawn(layer, y, start, end);
+  add_damage(&layer_damage, y, start, end);
+  return layer->cells + y * buffer_cols;
 }
 
-/////////////////
-// Public Api ///
-/////////////////
+// Recomputes the composite of all layers in [start, end) of row y. The drawn
+// span of the composite keeps covering exactly its non-blank cells.
+void composite_span(unsigned int y, unsigned int start, unsigned int end) {
+  struct FrameBuffer *contributing[LAYER_COUNT];
+  unsigned int contributing_count = 0;
+  for (int layer = LAYER_COUNT - 1; layer >= 0; layer--) {
+    struct FrameBuffer *l = &layers[layer];
+    if (row_live(l, y) && l->drawn[y].start < end && l->drawn[y].end > start) {
+      contributing[contributing_count++] = l;
+    }
+  }
 
-void init_terminalio(void) {
-  fprintf(stderr, "START");
-  if (!check_terminal_capabilities()) {
-    exit(-1);
+  revive_row(&next_frame_buffer, y);
+  struct Cell *row = next_frame_buffer.cells + y * buffer_cols;
+  unsigned int first = end, last = start;
+  for (unsigned int x = start; x < end; x++) {
+    struct Cell c = next_frame_buffer.blank;
+    for (unsigned int i = 0; i < contributing_count; i++) {
+      struct FrameBuffer *l = contributing[i];
+      struct Cell lc = l->cells[y * buffer_cols + x];
+      if (lc.codepoint != 0 && x >= l->drawn[y].start && x < l->drawn[y].end) {
+        c = lc;
+        break;
+      }
+    }
+    row[x] = c;
+    if (!blank_cell(c)) {
+      if (x < first) {
+        first = x;
+      }
+      last = x + 1;
+    }
   }
 
-  configure_terminal();
+  // the parts of the old span outside [start, end) are unchanged
+  struct Span *span = &next_frame_buffer.drawn[y];
+  struct Span updated = {buffer_cols, 0};
+  if (span->start < span->end && span->start < start) {
+    updated.start = span->start;
+    updated.end = min(span->end, start);
+  }
+  if (first < last) {
+    updated.start = min(updated.start, first);
+    updated.end = last;
+  }
+  if (span->start < span->end && span->end > end) {
+    updated.start = min(updated.start, span->start > end ? span->start : end);
+    updated.end = span->end;
+  }
+  *span = updated;
 
-  clear_screen();
+  uint64_t bit = (uint64_t)1 << (y % 64);
+  if (updated.start < updated.end) {
+    next_frame_buffer.drawn_rows[y / 64] |= bit;
+  } else {
+    next_frame_buffer.drawn_rows[y / 64] &= ~bit;
+  }
+}
 
-  set_screen_size();
-  signal(SIGWINCH, resize_signal);
+void composite_damage(void) {
+  for (unsigned int word = 0; word < bitmap_words(buffer_rows); word++) {
+    uint64_t rows = layer_damage.rows[word];
+    while (rows) {
+      unsigned int row = word * 64 + __builtin_ctzll(rows);
+      rows &= rows - 1;
+      composite_span(row, layer_damage.spans[row].start,
+                     layer_damage.spans[row].end);
+    }
+  }
+}
 
-  init_frame_buffers(screen_size_rows, screen_size_cols);
-  current_style = default_style();
+void copy_frame_buffer(struct FrameBuffer *to, struct FrameBuffer *from) {
+  memcpy(to->cells, from->cells,
+         (size_t)buffer_rows * buffer_cols * sizeof(struct Cell));
+  memcpy(to->drawn, from->drawn, buffer_rows * sizeof(struct Span));
+  memcpy(to->row_epochs, from->row_epochs, buffer_rows * sizeof(uint32_t));
+  memcpy(to->drawn_rows, from->drawn_rows,
+         bitmap_words(buffer_rows) * sizeof(uint64_t));
+  to->epoch = from->epoch;
 }
 
-int draw_display(unsigned int x, unsigned int y, struct Display d) {
-  if (x >= buffer_cols || y >= buffer_rows) {
-    return -1;
+struct FrameBuffer *frame_buffer(unsigned int index) {
+  if (index < LAYER_COUNT) {
+    return &layers[index];
   }
-
-  next_frame_buffer[y][x] = d;
-  return 0;
+  if (index == LAYER_COUNT) {
+    return &previous_frame_buffer;
+  }
+  if (index == LAYER_COUNT + 1) {
+    return &next_frame_buffer;
+  }
+  return &frame_slots[index - FRAME_BUFFER_COUNT];
 }
 
-int draw_sstring_va(int x, int y, struct Style style, char *format,
-                    va_list args) {
-  char string[100];
-  vsprintf(string, format, args);
+void free_frame_buffers(void) {
+  free(frame_buffers);
+  frame_buffers = NULL;
+  frame_buffer_capacity = 0;
+  free(drawn_spans);
+  drawn_spans = NULL;
+  free(row_epochs);
+  row_epochs = NULL;
+  free(row_hashes);
+  row_hashes = NULL;
+  free(row_hash_index);
+  row_hash_index = NULL;
+  free(drawn_rows);
+  drawn_rows = NULL;
+  drawn_rows_capacity = 0;
+}
 
-  int result;
-  for (unsigned int i = 0; i < strlen(string); i++) {
-    struct Display d;
-    d.character[0] = string[i];
-    d.character[1] = '\0';
-    d.style = style;
+// Makes room for all rows * cols buffers. The allocation only ever grows, so
+// shrinking the terminal (and growing it back) reuses the same memory.
+void reserve_frame_buffers(unsigned int rows, unsigned int cols) {
+  size_t size = (size_t)rows * cols;
+  if (size > frame_buffer_capacity) {
+    size_t bytes = frame_buffer_count * size * sizeof(struct Cell);
+    bytes = (bytes + FRAME_BUFFER_ALIGNMENT - 1) &
+            ~(size_t)(FRAME_BUFFER_ALIGNMENT - 1);
+
+    free(frame_buffers);
+    frame_buffers = aligned_alloc(FRAME_BUFFER_ALIGNMENT, bytes);
+    if (!frame_buffers) {
+      fprintf(stderr, "Could not allocate frame buffers.\n");
+      exit(-1);
+    }
+    frame_buffer_capacity = size;
+  }
 
-    result = draw_display(x + i, y, d);
-    if (result == -1) {
-      return -1;
+  // the spans and bitmaps of the damages come after those of the frame
+  // buffers
+  if (rows > drawn_rows_capacity) {
+    drawn_rows_capacity = bitmap_words(rows) * 64;
+    drawn_spans = realloc(drawn_spans, (frame_buffer_count + DAMAGE_COUNT) *
+                                           drawn_rows_capacity *
+                                           sizeof(struct Span));
+    row_epochs = realloc(row_epochs, frame_buffer_count * drawn_rows_capacity *
+                                         sizeof(uint32_t));
+    drawn_rows = realloc(drawn_rows, (frame_buffer_count + DAMAGE_COUNT) *
+                                         bitmap_words(drawn_rows_capacity) *
+                                         sizeof(uint64_t));
+    row_hashes =
+        realloc(row_hashes, 2 * drawn_rows_capacity * sizeof(uint64_t));
+    row_hash_index =
+        realloc(row_hash_index, 2 * drawn_rows_capacity * sizeof(int));
+    if (!drawn_spans || !row_epochs || !drawn_rows || !row_hashes ||
+        !row_hash_index) {
+      fprintf(stderr, "Could not allocate frame buffers.\n");
+      exit(-1);
     }
   }
-  return 0;
-}
 
-int draw_sstring(int x, int y, struct Style style, char *format, ...) {
+  buffer_rows = rows;
+  buffer_cols = cols;
+
+  unsigned int words = bitmap_words(drawn_rows_capacity);
+  for (unsigned int i = 0; i < frame_buffer_count; i++) {
+    struct FrameBuffer *buffer = frame_buffer(i);
+    buffer->cells = frame_buffers + i * frame_buffer_capacity;
+    buffer->blank = i < LAYER_COUNT ? transparent_cell() : empty_cell();
+    buffer->drawn = drawn_spans + i * drawn_rows_capacity;
+    buffer->row_epochs = row_epochs + i * drawn_rows_capacity;
+    buffer->drawn_rows = drawn_rows + i * words;
+    reset_frame_buffer(buffer, rows, cols);
+  }
+
+  struct Damage *damages[DAMAGE_COUNT] = {&layer_damage};
+  for (unsigned int i = 0; i < FRAME_SLOT_COUNT; i++) {
+    damages[1 + i] = &slot_damage[i];
+  }
+  for (unsigned int i = 0; i < DAMAGE_COUNT; i++) {
+    damages[i]->spans =
+        drawn_spans + (frame_buffer_count + i) * drawn_rows_capacity;
+    damages[i]->rows = drawn_rows + (frame_buffer_count + i) * words;
+    for (unsigned int row = 0; row < rows; row++) {
+      damages[i]->spans[row].start = cols;
+      damages[i]->spans[row].end = 0;
+    }
+    memset(damages[i]->rows, 0, words * sizeof(uint64_t));
+  }
+}
+
+void init_frame_buffers(unsigned int rows, unsigned int cols) {
+  reserve_frame_buffers(rows, cols);
+  atexit(free_frame_buffers);
+}
+
+void resize_frame_buffers(unsigned int rows, unsigned int cols) {
+  if (rows == buffer_rows && cols == buffer_cols) {
+    return;
+  }
+
+  reserve_frame_buffers(rows, cols);
+  clear_screen();
+  buffers_resized = true;
+}
+
+/////////////////////
+// Cursor Movement //
+/////////////////////
+
+// Like ncurses' mvcur, every way of getting the cursor from its position to
+// the target is priced in bytes and the cheapest one is emitted. Movements are
+// only considered when the terminal advertises them, they are then written as
+// the standard ANSI sequences.
+
+#define NO_MOVE UINT_MAX
+
+enum VerticalMove { V_NONE, V_DOWN, V_UP, V_LINE_FEEDS, V_ROW_ADDRESS };
+enum HorizontalMove {
+  H_NONE,
+  H_RIGHT,
+  H_LEFT,
+  H_BACKSPACES,
+  H_COLUMN_ADDRESS,
+  H_REWRITE,
+};
+
+unsigned int decimal_length(unsigned int n) {
+  unsigned int length = 1;
+  while (n >= 10) {
+    n /= 10;
+    length++;
+  }
+  return length;
+}
+
+// length of ESC [ n <final>, a parameter of 1 is left out
+unsigned int csi_cost(unsigned int n) {
+  return n == 1 ? 3 : 3 + decimal_length(n);
+}
+
+void output_csi(unsigned int n, char final) {
+  output_bytes("\033[", 2);
+  if (n != 1) {
+    output_uint(n);
+  }
+  output_char(final);
+}
+
+// Bytes needed to move right by writing the cells in [from, to) of a row
+// again. Only possible when they are unchanged on screen and already in the
+// current style, gives up once the cost reaches limit.
+unsigned int rewrite_cost(unsigned int from, unsigned int to, unsigned int y,
+                          unsigned int limit) {
+  struct Cell *previous_row = previous_frame_buffer.cells + y * buffer_cols;
+  struct Cell *next_row = target_frame->cells + y * buffer_cols;
+  unsigned int cost = 0;
+  for (unsigned int x = from; x < to; x++) {
+    if (!row_live(&previous_frame_buffer, y) ||
+        !row_live(target_frame, y) ||
+        !cell_equal(previous_row[x], next_row[x]) ||
+        next_row[x].style != current_style) {
+      return NO_MOVE;
+    }
+    char character[4];
+    cost += encode_utf8(next_row[x].codepoint, character);
+    if (cost >= limit) {
+      return NO_MOVE;
+    }
+  }
+  return cost;
+}
+
+unsigned int vertical_cost(unsigned int from, unsigned int to,
+                           enum VerticalMove *move) {
+  *move = V_NONE;
+  if (from == to) {
+    return 0;
+  }
+
+  unsigned int best = NO_MOVE;
+  if (movement.row_address) {
+    best = csi_cost(to + 1);
+    *move = V_ROW_ADDRESS;
+  }
+  if (to > from) {
+    if (movement.parm_down && csi_cost(to - from) < best) {
+      best = csi_cost(to - from);
+      *move = V_DOWN;
+    }
+    if (movement.line_feed && to - from < best) {
+      best = to - from;
+      *move = V_LINE_FEEDS;
+    }
+  } else if (movement.parm_up && csi_cost(from - to) < best) {
+    best = csi_cost(from - to);
+    *move = V_UP;
+  }
+  return best;
+}
+
+unsigned int horizontal_cost(unsigned int from, unsigned int to,
+                             unsigned int y, enum HorizontalMove *move) {
+  *move = H_NONE;
+  if (from == to) {
+    return 0;
+  }
+
+  unsigned int best = NO_MOVE;
+  if (movement.column_address) {
+    best = csi_cost(to + 1);
+    *move = H_COLUMN_ADDRESS;
+  }
+  if (to > from) {
+    if (movement.parm_right && csi_cost(to - from) < best) {
+      best = csi_cost(to - from);
+      *move = H_RIGHT;
+    }
+    unsigned int rewrite = rewrite_cost(from, to, y, best);
+    if (rewrite < best) {
+      best = rewrite;
+      *move = H_REWRITE;
+    }
+  } else {
+    if (movement.parm_left && csi_cost(from - to) < best) {
+      best = csi_cost(from - to);
+      *move = H_LEFT;
+    }
+    if (movement.backspace && from - to < best) {
+      best = from - to;
+      *move = H_BACKSPACES;
+    }
+  }
+  return best;
+}
+
+void output_vertical_move(enum VerticalMove move, unsigned int from,
+                          unsigned int to) {
+  switch (move) {
+  case V_NONE:
+    break;
+  case V_DOWN:
+    output_csi(to - from, 'B');
+    break;
+  case V_UP:
+    output_csi(from - to, 'A');
+    break;
+  case V_LINE_FEEDS:
+    for (unsigned int i = from; i < to; i++) {
+      output_char('\n');
+    }
+    break;
+  case V_ROW_ADDRESS:
+    output_csi(to + 1, 'd');
+    break;
+  }
+}
+
+void output_horizontal_move(enum HorizontalMove move, unsigned int from,
+                            unsigned int to, unsigned int y) {
+  switch (move) {
+  case H_NONE:
+    break;
+  case H_RIGHT:
+    output_csi(to - from, 'C');
+    break;
+  case H_LEFT:
+    output_csi(from - to, 'D');
+    break;
+  case H_BACKSPACES:
+    for (unsigned int i = to; i < from; i++) {
+      output_char('\b');
+    }
+    break;
+  case H_COLUMN_ADDRESS:
+    output_csi(to + 1, 'G');
+    break;
+  case H_REWRITE: {
+    struct Cell *row = target_frame->cells + y * buffer_cols;
+    for (unsigned int x = from; x < to; x++) {
+      char character[4];
+      output_bytes(character, encode_utf8(row[x].codepoint, character));
+    }
+    break;
+  }
+  }
+}
+
+void move_cursor(unsigned int x, unsigned int y) {
+  if (x == cursor_x && y == cursor_y) {
+    return;
+  }
+  render_counters.cursor_moves++;
+
+  // absolute position, always possible
+  unsigned int best = 4 + decimal_length(y + 1) + decimal_length(x + 1);
+  bool home = x == 0 && y == 0 && movement.cursor_home;
+  if (home) {
+    best = 3;
+  }
+
+  // relative movements need a known cursor position
+  enum VerticalMove vertical = V_NONE;
+  enum HorizontalMove horizontal = H_NONE;
+  bool carriage_return = false;
+  if (cursor_x < buffer_cols && cursor_y < buffer_rows) {
+    enum VerticalMove v;
+    enum HorizontalMove h;
+    unsigned int v_cost = vertical_cost(cursor_y, y, &v);
+    if (v_cost < best) {
+      unsigned int h_cost = horizontal_cost(cursor_x, x, y, &h);
+      if (h_cost != NO_MOVE && v_cost + h_cost < best) {
+        best = v_cost + h_cost;
+        vertical = v;
+        horizontal = h;
+        home = false;
+      }
+
+      if (movement.carriage_return && x < cursor_x) {
+        h_cost = 1 + horizontal_cost(0, x, y, &h);
+        if (h_cost != NO_MOVE && v_cost + h_cost < best) {
+          best = v_cost + h_cost;
+          vertical = v;
+          horizontal = h;
+          carriage_return = true;
+          home = false;
+        }
+      }
+    }
+  }
+
+  if (best == NO_MOVE || (vertical == V_NONE && horizontal == H_NONE &&
+                          !carriage_return)) {
+    if (home) {
+      output_bytes("\033[H", 3);
+    } else {
+      output_bytes("\033[", 2);
+      output_uint(y + 1);
+      output_char(';');
+      output_uint(x + 1);
+      output_char('H');
+    }
+  } else {
+    output_vertical_move(vertical, cursor_y, y);
+    if (carriage_return) {
+      output_char('\r');
+      output_horizontal_move(horizontal, 0, x, y);
+    } else {
+      output_horizontal_move(horizontal, cursor_x, x, y);
+    }
+  }
+
+  cursor_x = x;
+  cursor_y = y;
+}
+
+///////////////
+// Scrolling //
+///////////////
+
+// When a block of rows of the previous frame shows up shifted in the next
+// frame, the terminal scrolls it into place inside a scroll region and the
+// previous buffer is shifted to match, so the diff only sees what is left.
+
+#define BLANK_ROW_HASH 0
+#define MIN_SCROLL_ROWS 2
+#define MIN_DAMAGED_ROWS_FOR_SCROLL 4
+// set in the hash index for hashes shared by several previous rows
+#define DUPLICATE_ROW 0x40000000
+
+// Hash of the non-blank cells of a row and their positions, blank and stale
+// rows hash to BLANK_ROW_HASH no matter how they were drawn.
+uint64_t row_hash(struct FrameBuffer *buffer, unsigned int y) {
+  if (!row_live(buffer, y)) {
+    return BLANK_ROW_HASH;
+  }
+
+  struct Cell *row = buffer->cells + y * buffer_cols;
+  struct Span span = buffer->drawn[y];
+  uint64_t hash = BLANK_ROW_HASH;
+  for (unsigned int x = span.start; x < span.end; x++) {
+    if (blank_cell(row[x])) {
+      continue;
+    }
+    uint64_t h = ((uint64_t)row[x].style << 32 | row[x].codepoint) ^
+                 (uint64_t)x * 0x9E3779B97F4A7C15u;
+    h *= 0xBF58476D1CE4E5B9u;
+    hash += h ^ (h >> 31);
+  }
+  return hash;
+}
+
+bool rows_equal(unsigned int previous_y, unsigned int next_y) {
+  if (!row_live(&previous_frame_buffer, previous_y) ||
+      !row_live(target_frame, next_y)) {
+    return false;
+  }
+  struct Cell *previous_row =
+      previous_frame_buffer.cells + previous_y * buffer_cols;
+  struct Cell *next_row = target_frame->cells + next_y * buffer_cols;
+  return first_difference(previous_row, next_row, buffer_cols) == buffer_cols;
+}
+
+// Moves rows [top, bottom] of the previous buffer by offset rows (positive is
+// down), rows scrolled in become stale and read as blank.
+void shift_previous_rows(unsigned int top, unsigned int bottom, int offset) {
+  struct FrameBuffer *b = &previous_frame_buffer;
+  unsigned int count = bottom - top + 1 - abs(offset);
+  unsigned int from = offset > 0 ? top : top - offset;
+  unsigned int to = offset > 0 ? top + offset : top;
+
+  memmove(b->cells + to * buffer_cols, b->cells + from * buffer_cols,
+          (size_t)count * buffer_cols * sizeof(struct Cell));
+  memmove(b->drawn + to, b->drawn + from, count * sizeof(struct Span));
+  memmove(b->row_epochs + to, b->row_epochs + from, count * sizeof(uint32_t));
+
+  unsigned int exposed = offset > 0 ? top : bottom + 1 + offset;
+  for (unsigned int y = exposed; y < exposed + abs(offset); y++) {
+    b->drawn[y].start = 0;
+    b->drawn[y].end = buffer_cols;
+    b->row_epochs[y] = b->epoch - 1;
+  }
+  // every row of the region has to be diffed again
+  for (unsigned int y = top; y <= bottom; y++) {
+    add_damage(target_damage, y, 0, buffer_cols);
+  }
+}
+
+void scroll_region(unsigned int top, unsigned int bottom, int offset) {
+  set_style(DEFAULT_STYLE_ID);
+  output_bytes("\033[", 2);
+  output_uint(top + 1);
+  output_char(';');
+  output_uint(bottom + 1);
+  output_char('r');
+  output_csi(abs(offset), offset > 0 ? 'T' : 'S');
+  output_bytes("\033[r", 3);
+  // setting the scroll region moves the cursor home
+  cursor_x = 0;
+  cursor_y = 0;
+
+  shift_previous_rows(top, bottom, offset);
+}
+
+// Finds the longest block of rows that moved vertically between the previous
+// and the next frame and scrolls it.
+void scroll_frame(void) {
+  if (!scrolling.change_scroll_region ||
+      (!scrolling.parm_index && !scrolling.parm_rindex)) {
+    return;
+  }
+
+  unsigned int damaged = 0;
+  for (unsigned int word = 0; word < bitmap_words(buffer_rows); word++) {
+    damaged += __builtin_popcountll(target_damage->rows[word]);
+  }
+  if (damaged < MIN_DAMAGED_ROWS_FOR_SCROLL) {
+    return;
+  }
+
+  // index of previous rows by hash, rows whose hash is not unique are dropped
+  unsigned int table_size = 2 * buffer_rows;
+  uint64_t *previous_hashes = row_hashes;
+  uint64_t *next_hashes = row_hashes + buffer_rows;
+  for (unsigned int i = 0; i < table_size; i++) {
+    row_hash_index[i] = -1;
+  }
+  for (unsigned int y = 0; y < buffer_rows; y++) {
+    previous_hashes[y] = row_hash(&previous_frame_buffer, y);
+    next_hashes[y] = row_hash(target_frame, y);
+    if (previous_hashes[y] == BLANK_ROW_HASH) {
+      continue;
+    }
+
+    unsigned int slot = previous_hashes[y] % table_size;
+    while (row_hash_index[slot] != -1 &&
+           previous_hashes[row_hash_index[slot] & ~DUPLICATE_ROW] !=
+               previous_hashes[y]) {
+      slot = (slot + 1) % table_size;
+    }
+    if (row_hash_index[slot] == -1) {
+      row_hash_index[slot] = y;
+    } else {
+      row_hash_index[slot] |= DUPLICATE_ROW;
+    }
+  }
+
+  int best_offset = 0;
+  unsigned int best_start = 0, best_length = 0;
+  int run_offset = 0;
+  unsigned int run_start = 0, run_length = 0;
+  for (unsigned int y = 0; y < buffer_rows; y++) {
+    int offset = 0;
+    if (next_hashes[y] != BLANK_ROW_HASH &&
+        next_hashes[y] != previous_hashes[y]) {
+      unsigned int slot = next_hashes[y] % table_size;
+      while (row_hash_index[slot] != -1) {
+        int p = row_hash_index[slot] & ~DUPLICATE_ROW;
+        if (previous_hashes[p] == next_hashes[y]) {
+          if (!(row_hash_index[slot] & DUPLICATE_ROW)) {
+            offset = (int)y - p;
+          }
+          break;
+        }
+        slot = (slot + 1) % table_size;
+      }
+    }
+
+    if (offset != 0 && offset == run_offset && run_start + run_length == y) {
+      run_length++;
+    } else {
+      run_offset = offset;
+      run_start = y;
+      run_length = offset != 0;
+    }
+    if (run_length > best_length) {
+      best_offset = run_offset;
+      best_start = run_start;
+      best_length = run_length;
+    }
+  }
+
+  if (best_length < MIN_SCROLL_ROWS ||
+      !(best_offset > 0 ? scrolling.parm_rindex : scrolling.parm_index)) {
+    return;
+  }
+  for (unsigned int y = best_start; y < best_start + best_length; y++) {
+    if (!rows_equal(y - best_offset, y)) {
+      return;
+    }
+  }
+
+  if (best_offset > 0) {
+    scroll_region(best_start - best_offset, best_start + best_length - 1,
+                  best_offset);
+  } else {
+    scroll_region(best_start, best_start + best_length - 1 - best_offset,
+                  best_offset);
+  }
+}
+
+///////////////////////
+// Render Functions ///
+///////////////////////
+
+void render_cell(unsigned int x, unsigned int y, struct Cell c) {
+  move_cursor(x, y);
+  set_style(c.style);
+  char character[4];
+  output_bytes(character, encode_utf8(c.codepoint, character));
+  cursor_x++;
+  render_counters.cells_emitted++;
+}
+
+// Erases use the current background, so they are always done in the default
+// style.
+void erase_to_end_of_line(unsigned int x, unsigned int y) {
+  move_cursor(x, y);
+  set_style(DEFAULT_STYLE_ID);
+  output_bytes("\033[K", 3);
+}
+
+void erase_below(unsigned int y) {
+  move_cursor(0, y);
+  set_style(DEFAULT_STYLE_ID);
+  output_bytes("\033[J", 3);
+}
+
+// Renders count copies of cell c starting at x, with one erase or repeat
+// sequence when that is shorter than writing every cell. Returns false when
+// writing the cells one by one is cheapest.
+bool render_run(unsigned int x, unsigned int y, struct Cell c,
+                unsigned int count) {
+  char character[4];
+  unsigned int length = encode_utf8(c.codepoint, character);
+  unsigned int plain = count * length;
+  // switching to the default style for an erase, and moving past it afterwards
+  // since it leaves the cursor in place
+  unsigned int erase_overhead = (current_style != DEFAULT_STYLE_ID ? 4 : 0) + 4;
+
+  if (erase.erase_chars && blank_cell(c) &&
+      csi_cost(count) + erase_overhead < plain) {
+    move_cursor(x, y);
+    set_style(DEFAULT_STYLE_ID);
+    output_csi(count, 'X');
+    render_counters.cells_emitted += count;
+    return true;
+  }
+
+  if (erase.repeat_char && count > 1 && length + csi_cost(count - 1) < plain) {
+    render_cell(x, y, c);
+    output_csi(count - 1, 'b');
+    cursor_x += count - 1;
+    render_counters.cells_emitted += count - 1;
+    return true;
+  }
+
+  return false;
+}
+
+// Renders every cell in [start, end) of a row that differs between the two
+// buffers.
+void render_span(unsigned int row, unsigned int start, unsigned int end) {
+  struct Cell *previous_row = previous_frame_buffer.cells + row * buffer_cols;
+  struct Cell *next_row = target_frame->cells + row * buffer_cols;
+  unsigned int next_end = target_frame->drawn[row].end;
+  unsigned int col = start;
+  while (true) {
+    col += first_difference(previous_row + col, next_row + col, end - col);
+    if (col >= end) {
+      break;
+    }
+
+    // the rest of the row is blank in the next frame
+    if (erase.clr_eol && col >= next_end && end - col > 3) {
+      erase_to_end_of_line(col, row);
+      break;
+    }
+
+    // render the changed span, the next equal cell ends it
+    do {
+      unsigned int run = 1;
+      while (col + run < end &&
+             cell_equal(next_row[col + run], next_row[col])) {
+        run++;
+      }
+      if (run == 1 || !render_run(col, row, next_row[col], run)) {
+        for (unsigned int i = 0; i < run; i++) {
+          render_cell(col + i, row, next_row[col]);
+        }
+      }
+      col += run;
+    } while (col < end && !cell_equal(previous_row[col], next_row[col]));
+  }
+}
+
+// Last row of buffer that is live and was drawn into, -1 if there is none.
+int last_drawn_row(struct FrameBuffer *buffer) {
+  for (int word = bitmap_words(buffer_rows) - 1; word >= 0; word--) {
+    uint64_t rows = buffer->drawn_rows[word];
+    while (rows) {
+      unsigned int bit = 63 - __builtin_clzll(rows);
+      unsigned int row = word * 64 + bit;
+      if (row_live(buffer, row)) {
+        return row;
+      }
+      rows &= ~((uint64_t)1 << bit);
+    }
+  }
+  return -1;
+}
+
+//////////////////
+// Backpressure //
+//////////////////
+
+// More bytes than this in the kernel queue means the terminal is behind.
+// Ptys do not report their queue, there only output the terminal did not take
+// without blocking counts.
+#define OUTPUT_QUEUE_LIMIT 4096
+// how often the render thread retries writing while the terminal is behind
+#define OUTPUT_RETRY_NANOSECONDS 2000000
+
+// Frames that were composited but never put on the screen, and frames put on
+// the screen that covered one or more of them. Without a render thread a
+// frame is dropped while the terminal is behind, with one when the next frame
+// replaces it before the render thread picked it up.
+atomic_uint frames_dropped;
+atomic_uint frames_coalesced;
+// without a render thread, a frame was dropped since the last one that was
+// presented
+bool frames_skipped;
+bool frame_drops_disabled;
+
+// what render_frame spent and did on the calling thread since the last
+// take_render_profile
+struct FrameInfo render_profile;
+
+bool output_behind(void) {
+  return !output_drain() || output_queued() > OUTPUT_QUEUE_LIMIT;
+}
+
+// Puts target_frame on the screen, it is only diffed against what the screen
+// shows inside target_damage. Adds its phases and counters to profile.
+void present_frame(struct FrameInfo *profile) {
+  int64_t mark = now();
+  scroll_frame();
+  end_phase(profile, PHASE_SCROLL, &mark);
+
+  int last_next_row = last_drawn_row(target_frame);
+
+  for (unsigned int word = 0; word < bitmap_words(buffer_rows); word++) {
+    uint64_t rows = target_damage->rows[word];
+    while (rows) {
+      unsigned int row = word * 64 + __builtin_ctzll(rows);
+      rows &= rows - 1;
+
+      // everything from here down is blank in the next frame
+      if (erase.clr_eos && (int)row > last_next_row) {
+        erase_below(row);
+        for (unsigned int y = row; y < buffer_rows; y++) {
+          expire_row(&previous_frame_buffer, y);
+        }
+        word = bitmap_words(buffer_rows);
+        break;
+      }
+
+      revive_row(&previous_frame_buffer, row);
+      revive_row(target_frame, row);
+      struct Span span = target_damage->spans[row];
+      render_span(row, span.start, span.end);
+      render_counters.cells_diffed += span.end - span.start;
+
+      // the screen now shows the frame in the damaged span
+      memcpy(previous_frame_buffer.cells + row * buffer_cols + span.start,
+             target_frame->cells + row * buffer_cols + span.start,
+             (span.end - span.start) * sizeof(struct Cell));
+      previous_frame_buffer.drawn[row] = target_frame->drawn[row];
+      previous_frame_buffer.drawn_rows[row / 64] |= (uint64_t)1 << (row % 64);
+    }
+  }
+  clear_damage(target_damage);
+  end_phase(profile, PHASE_DIFF, &mark);
+
+  struct FrameInfo counted = {0};
+  counted.counters = render_counters;
+  add_frame_profile(profile, &counted);
+  memset(&render_counters, 0, sizeof(render_counters));
+}
+
+// Writes what the terminal takes without blocking, accounted to profile.
+bool drain_output(struct FrameInfo *profile) {
+  uint64_t bytes, writes, bytes_after, writes_after;
+  output_stats(&bytes, &writes);
+  int64_t mark = now();
+
+  bool drained = output_drain();
+
+  end_phase(profile, PHASE_FLUSH, &mark);
+  output_stats(&bytes_after, &writes_after);
+  profile->counters.bytes_written += bytes_after - bytes;
+  profile->counters.write_calls += writes_after - writes;
+  trace_counter("bytes written", mark, bytes_after - bytes);
+  trace_counter("output pending", mark, output_pending());
+  return drained;
+}
+
+///////////////////
+// Render Thread //
+///////////////////
+
+// Slot indices of the triple buffer. render_frame copies the composite into
+// back_slot and swaps it with middle_slot, the render thread swaps
+// front_slot with middle_slot when FRESH_SLOT marks a frame it has not seen
+// yet. Neither side ever waits for the other, and the render thread always
+// picks up the newest complete frame. A slot's damage is what changed since
+// the frame before it, COVERS_DROPS marks a frame that replaced one the
+// render thread never saw, its damage alone is then not enough.
+#define FRESH_SLOT 4
+#define COVERS_DROPS 8
+#define SLOT_INDEX 3
+
+unsigned int back_slot = 0;
+atomic_uint middle_slot = 1;
+unsigned int front_slot = 2;
+
+bool render_thread_started;
+pthread_t render_thread;
+atomic_bool render_thread_stopping;
+sem_t frames_published;
+// Held by the render thread while it uses the screen model or writes to the
+// terminal. render_frame only takes it to reallocate the frame buffers after
+// a resize.
+pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define RENDER_FRAMES_SIZE 600
+#define RENDER_PROFILE_INTERVAL 60
+struct FrameInfo render_frames_data[RENDER_FRAMES_SIZE];
+struct FrameInfoBuffer render_frame_info;
+atomic_int render_fps;
+_Atomic int64_t render_active_time;
+// averaged over the render thread's recent frames every
+// RENDER_PROFILE_INTERVAL frames
+pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+struct FrameInfo render_thread_average;
+bool render_thread_average_ready;
+
+// Hands the composite and layer_damage over to the render thread, which
+// leaves layer_damage empty.
+void publish_frame(void) {
+  copy_frame_buffer(&frame_slots[back_slot], &next_frame_buffer);
+  // the damage of a dropped frame may still be in the slot
+  struct Damage published = layer_damage;
+  layer_damage = slot_damage[back_slot];
+  slot_damage[back_slot] = published;
+  clear_damage(&layer_damage);
+  unsigned int previous = atomic_load_explicit(&middle_slot,
+                                               memory_order_relaxed);
+  unsigned int next;
+  do {
+    next = back_slot | FRESH_SLOT;
+    if (previous & FRESH_SLOT) {
+      next |= COVERS_DROPS;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(
+      &middle_slot, &previous, next, memory_order_acq_rel,
+      memory_order_relaxed));
+  // the render thread never picked up the frame this one replaces
+  if (previous & FRESH_SLOT) {
+    frames_dropped++;
+    trace_instant("frame dropped", now());
+  }
+  back_slot = previous & SLOT_INDEX;
+  sem_post(&frames_published);
+}
+
+// The damage of dropped frames is unknown to the render thread, so it diffs
+// everything drawn in the frame that covers them or still on the screen.
+void damage_drawn_rows(struct FrameBuffer *frame, struct Damage *damage) {
+  for (unsigned int word = 0; word < bitmap_words(buffer_rows); word++) {
+    uint64_t rows =
+        frame->drawn_rows[word] | previous_frame_buffer.drawn_rows[word];
+    while (rows) {
+      unsigned int row = word * 64 + __builtin_ctzll(rows);
+      rows &= rows - 1;
+      if (row_live(frame, row)) {
+        add_damage(damage, row, frame->drawn[row].start, frame->drawn[row].end);
+      }
+      if (row_live(&previous_frame_buffer, row)) {
+        add_damage(damage, row, previous_frame_buffer.drawn[row].start,
+                   previous_frame_buffer.drawn[row].end);
+      }
+    }
+  }
+}
+
+// Waits for the next published frame. While the terminal is behind, it only
+// waits for a short while to write pending output again.
+bool wait_for_frame(bool behind) {
+  if (!behind) {
+    return sem_wait(&frames_published) == 0;
+  }
+
+  // on the clock of now(), a step of the wall clock does not move it
+  struct timespec deadline =
+      nanoseconds_to_timespec(now() + OUTPUT_RETRY_NANOSECONDS);
+  return sem_clockwait(&frames_published, CLOCK_MONOTONIC, &deadline) == 0 ||
+         errno == ETIMEDOUT;
+}
+
+void *render_loop(void *argument) {
+  (void)argument;
+  trace_thread_name("render");
+  bool behind = false;
+  while (!atomic_load(&render_thread_stopping)) {
+    if (!wait_for_frame(behind)) {
+      continue;
+    }
+
+    pthread_mutex_lock(&render_lock);
+    // a frame left in the middle slot is dropped once the next is published
+    behind = output_behind();
+    if (behind || !(atomic_load(&middle_slot) & FRESH_SLOT)) {
+      pthread_mutex_unlock(&render_lock);
+      continue;
+    }
+    render_frame_info.current_frame->start = now();
+
+    unsigned int slot = atomic_exchange_explicit(&middle_slot, front_slot,
+                                                 memory_order_acq_rel);
+    front_slot = slot & SLOT_INDEX;
+    target_frame = &frame_slots[front_slot];
+    target_damage = &slot_damage[front_slot];
+    if (slot & COVERS_DROPS) {
+      damage_drawn_rows(target_frame, target_damage);
+      frames_coalesced++;
+      trace_instant("frames coalesced", render_frame_info.current_frame->start);
+    }
+    present_frame(render_frame_info.current_frame);
+    behind = !drain_output(render_frame_info.current_frame);
+
+    render_frame_info.current_frame->end = now();
+    trace_span("present", render_frame_info.current_frame->start,
+               render_frame_info.current_frame->end);
+    advance_frame_info_buffer(&render_frame_info);
+    atomic_store(&render_fps, average_fps(&render_frame_info));
+    atomic_store(&render_active_time, average_active_time(&render_frame_info));
+    if (render_frame_info.current_frame_index % RENDER_PROFILE_INTERVAL == 0) {
+      pthread_mutex_lock(&profile_lock);
+      render_thread_average_ready =
+          average_frame_profile(&render_frame_info, &render_thread_average);
+      pthread_mutex_unlock(&profile_lock);
+    }
+    pthread_mutex_unlock(&render_lock);
+  }
+  return NULL;
+}
+
+void stop_render_thread(void) {
+  atomic_store(&render_thread_stopping, true);
+  sem_post(&frames_published);
+  pthread_join(render_thread, NULL);
+  render_thread_started = false;
+}
+
+/////////////////
+// Public Api ///
+/////////////////
+
+void init_terminalio(void) {
+  fprintf(stderr, "START");
+  if (!check_terminal_capabilities()) {
+    exit(-1);
+  }
+  atexit(free_output);
+  // before restore_terminal is registered, so it runs after it
+  atexit(report_style_overflow);
+
+  configure_terminal();
+
+  clear_screen();
+
+  set_screen_size();
+
+  init_styles();
+  clear_sgr_cache();
+  init_row_diff();
+  init_frame_buffers(screen_size_rows, screen_size_cols);
+  current_style = DEFAULT_STYLE_ID;
+}
+
+bool init_terminalio_headless(unsigned int rows, unsigned int cols) {
+  const char *term = getenv("TERM");
+  if (!load_terminal_capabilities(term ? term : HEADLESS_TERM)) {
+    return false;
+  }
+  atexit(free_output);
+  headless = true;
+
+  clear_screen();
+
+  screen_size_rows = rows;
+  screen_size_cols = cols;
+
+  init_styles();
+  clear_sgr_cache();
+  init_row_diff();
+  init_frame_buffers(screen_size_rows, screen_size_cols);
+  current_style = DEFAULT_STYLE_ID;
+  return true;
+}
+
+int draw_display(unsigned int x, unsigned int y, struct Display d) {
+  if (x >= buffer_cols || y >= buffer_rows) {
+    return -1;
+  }
+
+  struct Cell *row = draw_into_layer(&layers[selected_layer], y, x, x + 1);
+  row[x] = display_cell(&d);
+  return 0;
+}
+
+// Copies count cells into row y of the layer starting at column x, clipped to
+// the screen. Returns -1 when something was cut off.
+int blit_cells(struct FrameBuffer *layer, int x, int y,
+               const struct Cell *cells, unsigned int count) {
+  if (x < 0 || y < 0 || (unsigned int)y >= buffer_rows) {
+    return -1;
+  }
+
+  int result = 0;
+  if (x + count > buffer_cols) {
+    count = x < (int)buffer_cols ? buffer_cols - x : 0;
+    result = -1;
+  }
+  if (count == 0) {
+    return result;
+  }
+
+  struct Cell *row = draw_into_layer(layer, y, x, x + count);
+  memcpy(row + x, cells, count * sizeof(struct Cell));
+  return result;
+}
+
+int draw_sstring_va(int x, int y, struct Style style, char *format,
+                    va_list args) {
+  char string[TEXT_SIZE * 4];
+  vsnprintf(string, sizeof(string), format, args);
+
+  struct Cell cells[TEXT_SIZE * 4];
+  unsigned int count =
+      rasterize_text(string, intern_style(&style), cells, TEXT_SIZE * 4);
+  return blit_cells(&layers[selected_layer], x, y, cells, count);
+}
+
+int draw_sstring(int x, int y, struct Style style, char *format, ...) {
   va_list args;
   va_start(args, format);
   int result = draw_sstring_va(x, y, style, format, args);
@@ -644,37 +1975,224 @@ int draw_string(int x, int y, char *format, ...) {
   return result;
 }
 
-void render_frame(void) {
+// Resizes the frame buffers to the last known screen size, the render thread
+// must not use them meanwhile.
+void apply_screen_size(void) {
+  if (screen_size_rows == buffer_rows && screen_size_cols == buffer_cols) {
+    return;
+  }
 
-  for (unsigned int row = 0; row < buffer_rows; row++) {
-    for (unsigned int col = 0; col < buffer_cols; col++) {
-      if (!display_equal(&previous_frame_buffer[row][col],
-                         &next_frame_buffer[row][col])) {
-        render_display(col, row, next_frame_buffer[row][col]);
-      }
+  int64_t start = now();
+  if (render_thread_started) {
+    pthread_mutex_lock(&render_lock);
+  }
+  resize_frame_buffers(screen_size_rows, screen_size_cols);
+  if (render_thread_started) {
+    pthread_mutex_unlock(&render_lock);
+  }
+  trace_span("resize", start, now());
+}
+
+bool start_render_thread(void) {
+  if (render_thread_started) {
+    return true;
+  }
+
+  // the frame slots are allocated together with the other frame buffers
+  unsigned int rows = buffer_rows, cols = buffer_cols;
+  free_frame_buffers();
+  frame_buffer_count = FRAME_BUFFER_COUNT + FRAME_SLOT_COUNT;
+  reserve_frame_buffers(rows, cols);
+
+  render_frame_info =
+      initialize_frame_info_buffer(render_frames_data, RENDER_FRAMES_SIZE);
+  if (sem_init(&frames_published, 0, 0) != 0) {
+    return false;
+  }
+
+  if (start_thread(&render_thread, render_loop) != 0) {
+    return false;
+  }
+
+  render_thread_started = true;
+  atexit(stop_render_thread);
+  return true;
+}
+
+bool render_thread_stats(int *fps, int64_t *active_time) {
+  if (!render_thread_started) {
+    return false;
+  }
+  *fps = atomic_load(&render_fps);
+  *active_time = atomic_load(&render_active_time);
+  return true;
+}
+
+void frame_drop_stats(unsigned int *dropped, unsigned int *coalesced) {
+  *dropped = atomic_load(&frames_dropped);
+  *coalesced = atomic_load(&frames_coalesced);
+}
+
+struct Cell frame_cell(unsigned int x, unsigned int y) {
+  if (x >= buffer_cols || y >= buffer_rows ||
+      !row_live(&next_frame_buffer, y)) {
+    return next_frame_buffer.blank;
+  }
+  return next_frame_buffer.cells[y * buffer_cols + x];
+}
+
+struct Style cell_style(uint32_t style) {
+  if (style >= styles_count) {
+    return default_style();
+  }
+  return styles[style].style;
+}
+
+void disable_frame_drops(void) { frame_drops_disabled = true; }
+
+void select_layer(enum Layer layer) { selected_layer = layer; }
+
+void clear_layer(enum Layer layer) { clear_layer_buffer(&layers[layer]); }
+
+bool screen_resized(void) {
+  bool resized = buffers_resized;
+  buffers_resized = false;
+  return resized;
+}
+
+void render_frame(void) {
+  int64_t mark = now();
+  composite_damage();
+  if (render_thread_started) {
+    publish_frame();
+    end_phase(&render_profile, PHASE_COMPOSITE, &mark);
+  } else if (!frame_drops_disabled && output_behind()) {
+    // the damage is kept, so the next frame that is presented covers this one
+    frames_dropped++;
+    frames_skipped = true;
+    trace_instant("frame dropped", mark);
+  } else {
+    end_phase(&render_profile, PHASE_COMPOSITE, &mark);
+    present_frame(&render_profile);
+    if (frames_skipped) {
+      frames_coalesced++;
+      frames_skipped = false;
+      trace_instant("frames coalesced", mark);
     }
   }
 
-  clear_frame_buffer(previous_frame_buffer, buffer_rows, buffer_cols);
-  switch_frame_buffers();
+  // the entities layer is redrawn every frame, what it showed is damaged
+  clear_layer_buffer(&layers[LAYER_ENTITIES]);
 
-  resize_frame_buffers(screen_size_rows, screen_size_cols);
+  apply_screen_size();
+  if (!render_thread_started) {
+    drain_output(&render_profile);
+  }
+}
+
+void take_render_profile(struct FrameInfo *frame) {
+  add_frame_profile(frame, &render_profile);
+  memset(&render_profile, 0, sizeof(render_profile));
+}
+
+bool render_thread_profile(struct FrameInfo *average) {
+  if (!render_thread_started) {
+    return false;
+  }
+  pthread_mutex_lock(&profile_lock);
+  *average = render_thread_average;
+  bool ready = render_thread_average_ready;
+  pthread_mutex_unlock(&profile_lock);
+  return ready;
+}
+
+void update_screen_size(void) {
+  set_screen_size();
+  apply_screen_size();
+}
+
+void resize_headless(unsigned int rows, unsigned int cols) {
+  screen_size_rows = rows;
+  screen_size_cols = cols;
+  apply_screen_size();
+}
+
+//////////////////
+// Text Widgets //
+//////////////////
+
+void init_text(struct Text *text, enum Layer layer, int x, int y,
+               struct Style style, const char *format) {
+  text->layer = layer;
+  text->x = x;
+  text->y = y;
+  text->style = style;
+  text->format = format;
+  text->value = 0;
+  text->content[0] = '\0';
+  text->length = 0;
+  text->shown_length = 0;
+  text->formatted = false;
+}
+
+// Rasterizes the content, a retained layer gets the new cells right away.
+// Cells the previous content covered are made transparent again.
+void rasterize_text_widget(struct Text *text) {
+  text->length = rasterize_text(text->content, intern_style(&text->style),
+                                text->cells, TEXT_SIZE);
+  if (text->layer == LAYER_ENTITIES) {
+    return;
+  }
+
+  for (unsigned int i = text->length; i < text->shown_length; i++) {
+    text->cells[i] = transparent_cell();
+  }
+  blit_cells(&layers[text->layer], text->x, text->y, text->cells,
+             max(text->length, text->shown_length));
+  text->shown_length = text->length;
+}
+
+bool set_text(struct Text *text, const char *content) {
+  if (text->formatted && strcmp(text->content, content) == 0) {
+    return false;
+  }
+  snprintf(text->content, sizeof(text->content), "%s", content);
+  text->formatted = true;
+  rasterize_text_widget(text);
+  return true;
+}
+
+bool set_text_value(struct Text *text, long value) {
+  if (text->formatted && text->value == value) {
+    return false;
+  }
+  snprintf(text->content, sizeof(text->content), text->format, value);
+  text->value = value;
+  text->formatted = true;
+  rasterize_text_widget(text);
+  return true;
+}
 
-  fflush(stdout);
+int draw_text(struct Text *text) {
+  text->shown_length = text->length;
+  return blit_cells(&layers[text->layer], text->x, text->y, text->cells,
+                    text->length);
 }
 
-void read_input(char *buf, unsigned int buf_len) {
+unsigned int read_input(char *buf, unsigned int buf_len) {
+  // stdin stays blocking, it is only read once it has something
+  struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+  if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLIN | POLLHUP))) {
+    buf[0] = '\0';
+    return 0;
+  }
   ssize_t read_bytes = read(STDIN_FILENO, buf, (buf_len - 1) * sizeof(char));
   if (read_bytes == -1) {
     buf[0] = '\0';
-  } else {
-    buf[read_bytes] = '\0';
-  }
-
-  for (ssize_t i = 0; i < read_bytes; i++) {
-    buf[i] = buf[i];
-    buf[i + 1] = '\0';
+    return 0;
   }
+  buf[read_bytes] = '\0';
+  return read_bytes;
 }
 
 unsigned int get_max_x(void) { return buffer_cols; }
@@ -1,5 +1,7 @@
 #ifndef terminalio_h
 #define terminalio_h
+#include "cell.h"
+#include "frame_info.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -27,10 +29,11 @@ enum OutputMode {
   STRIKETHROUGH = 9,
 };
 
-struct ModesList {
-  uint8_t count;
-  enum OutputMode modes[10];
-};
+#define MODE_BIT(mode) ((uint16_t)1 << (mode))
+#define MODES_MASK                                                             \
+  (MODE_BIT(BOLD) | MODE_BIT(DIM) | MODE_BIT(ITALIC) | MODE_BIT(UNDERLINE) |   \
+   MODE_BIT(BLINKING) | MODE_BIT(INVERSE) | MODE_BIT(HIDDEN) |                 \
+   MODE_BIT(STRIKETHROUGH))
 
 struct Color {
   enum ColorType type;
@@ -40,7 +43,7 @@ struct Color {
 
 struct Style {
   struct Color color, background;
-  struct ModesList modes_list;
+  uint16_t modes; // bitmask of MODE_BIT(enum OutputMode)
 };
 
 struct Display {
@@ -48,13 +51,97 @@ struct Display {
   struct Style style;
 };
 
+// Layers are composited in this order, later layers cover earlier ones where
+// something was drawn into them. LAYER_ENTITIES is cleared after every frame,
+// the other layers keep what was drawn into them until clear_layer.
+enum Layer {
+  LAYER_LEVEL,
+  LAYER_ENTITIES,
+  LAYER_HUD,
+  LAYER_OVERLAY,
+  LAYER_COUNT,
+};
+
 void init_terminalio(void);
+// Renders without a terminal, e.g. for benchmarks: the terminal is not
+// configured, the screen has the given size until resize_headless and output
+// goes wherever output_to_fd or output_to_sink in output.h send it. Uses the
+// terminfo entry of TERM, or xterm-256color when it is not set.
+bool init_terminalio_headless(unsigned int rows, unsigned int cols);
+void resize_headless(unsigned int rows, unsigned int cols);
 int draw_display(unsigned int x, unsigned int y, struct Display d);
 int draw_sstring(int x, int y, struct Style style, char *format, ...);
 int draw_string(int x, int y, char *format, ...);
 void render_frame(void);
 
-void read_input(char *buf, unsigned int buf_len);
+// Moves diffing and writing to the terminal onto a render thread, call it
+// right after init_terminalio. render_frame then only hands the composited
+// frame over and never waits for the terminal. Returns false when the thread
+// could not be started, rendering then stays on the calling thread.
+bool start_render_thread(void);
+// Average FPS and active time in nanoseconds of the render thread over its
+// recent frames, false without a render thread.
+bool render_thread_stats(int *fps, int64_t *active_time);
+// Adds the phases and counters of render_frame since the last call to frame.
+// With a render thread, only compositing happens on the calling thread, the
+// rest is reported by render_thread_profile.
+void take_render_profile(struct FrameInfo *frame);
+// Average profile of the render thread's recent frames, false without one.
+bool render_thread_profile(struct FrameInfo *average);
+// Frames composited but never put on the screen, because the terminal did not
+// keep up or the render thread was still busy, and frames put on the screen
+// that covered one or more of them.
+void frame_drop_stats(unsigned int *dropped, unsigned int *coalesced);
+// render_frame then waits for the terminal instead of dropping frames, so
+// the same frames always reach the screen, e.g. in a replay.
+void disable_frame_drops(void);
+// What the composited frame shows at (x, y), and the style a cell's style id
+// stands for, e.g. to check the output against a terminal emulator.
+struct Cell frame_cell(unsigned int x, unsigned int y);
+struct Style cell_style(uint32_t style);
+// How often a style was drawn in the default style because all MAX_STYLES
+// styles in the table were taken. A terminal session reports it on exit.
+unsigned int style_overflows(void);
+
+// draw functions write into the selected layer, LAYER_ENTITIES by default
+void select_layer(enum Layer layer);
+void clear_layer(enum Layer layer);
+// True once after the screen was resized, all layers are cleared then.
+bool screen_resized(void);
+// Reads the screen size and resizes right away. Resizes are not picked up
+// otherwise, call it when the event loop reports EVENT_RESIZE (events.h).
+void update_screen_size(void);
+
+// A retained line of text. It keeps its formatted content and the cells it
+// rasterizes to, and only formats and decodes again when the content changes.
+#define TEXT_SIZE 64
+
+struct Text {
+  enum Layer layer;
+  int x, y;
+  struct Style style;
+  // printf format of set_text_value, taking one long
+  const char *format;
+  long value;
+  char content[TEXT_SIZE];
+  struct Cell cells[TEXT_SIZE];
+  unsigned int length;
+  unsigned int shown_length;
+  bool formatted;
+};
+
+void init_text(struct Text *text, enum Layer layer, int x, int y,
+               struct Style style, const char *format);
+// Both return true when the content changed. Text in a retained layer is
+// updated in its layer right away, text in LAYER_ENTITIES has to be drawn
+// every frame with draw_text.
+bool set_text(struct Text *text, const char *content);
+bool set_text_value(struct Text *text, long value);
+// Copies the cells of the text into its layer, e.g. after a resize.
+int draw_text(struct Text *text);
+
+// Reads what is available into buf, NUL terminated, and returns its length.
+unsigned int read_input(char *buf, unsigned int buf_len);
 
 struct Color default_color(void);
 struct Color color_rgb(uint8_t r, uint8_t g, uint8_t b);
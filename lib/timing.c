@@ -1,41 +1,73 @@
 #include "timing.h"
-#include <sys/select.h>
+#include <errno.h>
 #include <time.h>
-#include <unistd.h>
 
-int64_t timespec_to_milliseconds(struct timespec ts) {
-  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+int64_t timespec_to_nanoseconds(struct timespec ts) {
+  return ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
 }
 
-struct timespec milliseconds_to_timespec(int64_t milliseconds) {
+struct timespec nanoseconds_to_timespec(int64_t nanoseconds) {
   struct timespec ts;
-  ts.tv_sec = milliseconds / 1000;
-  ts.tv_nsec = (milliseconds % 1000) * 1000000;
+  ts.tv_sec = nanoseconds / NANOSECONDS_PER_SECOND;
+  ts.tv_nsec = nanoseconds % NANOSECONDS_PER_SECOND;
   return ts;
 }
 
-struct timeval milliseconds_to_timeval(int64_t milliseconds) {
-  struct timeval tv;
-  tv.tv_sec = milliseconds / 1000;
-  tv.tv_usec = (milliseconds % 1000) * 1000;
-  return tv;
-}
-
 int64_t now(void) {
   struct timespec ts;
-  clock_gettime(CLOCK_REALTIME, &ts);
-  return timespec_to_milliseconds(ts);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return timespec_to_nanoseconds(ts);
+}
+
+void sleep_until(int64_t time) {
+  struct timespec ts = nanoseconds_to_timespec(time);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+void reset_lateness(struct FrameScheduler *s) {
+  s->wakeups = 0;
+  s->total_lateness = 0;
+  s->maximum_lateness = 0;
+  s->missed_deadlines = 0;
+}
+
+void init_frame_scheduler(struct FrameScheduler *s, int64_t period,
+                          int64_t spin) {
+  s->period = period;
+  s->spin = spin;
+  s->deadline = now() + period;
+  reset_lateness(s);
+}
+
+int64_t first_frame_tick(struct FrameScheduler *s) {
+  return s->deadline - s->spin;
 }
 
-void wait(int64_t time) {
-  if (time < 0) {
-    return;
+int64_t start_frame(struct FrameScheduler *s, uint64_t ticks) {
+  if (ticks > 1) {
+    s->missed_deadlines += ticks - 1;
+    s->deadline += (ticks - 1) * s->period;
+  }
+
+  int64_t time;
+  while ((time = now()) < s->deadline) {
+  }
+
+  int64_t lateness = time - s->deadline;
+  s->wakeups++;
+  s->total_lateness += lateness;
+  if (lateness > s->maximum_lateness) {
+    s->maximum_lateness = lateness;
   }
 
-  struct timespec ts = milliseconds_to_timespec(time);
-  nanosleep(&ts, NULL);
+  s->deadline += s->period;
+  return lateness;
 }
 
-int64_t until_end_of_frame(int64_t start_time, uint16_t target_frame_time) {
-  return target_frame_time - (now() - start_time);
+int64_t average_lateness(struct FrameScheduler *s) {
+  if (s->wakeups == 0) {
+    return 0;
+  }
+  return s->total_lateness / s->wakeups;
 }
@@ -2,8 +2,41 @@
 #define timing_h
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
+#define NANOSECONDS_PER_SECOND 1000000000LL
+#define NANOSECONDS_PER_MILLISECOND 1000000LL
+#define NANOSECONDS_PER_MICROSECOND 1000LL
+
+// nanoseconds on CLOCK_MONOTONIC, unaffected by changes to the wall clock
 int64_t now(void);
-void wait(int64_t time);
-int64_t until_end_of_frame(int64_t start_time, uint16_t target_frame_time);
+struct timespec nanoseconds_to_timespec(int64_t nanoseconds);
+// sleeps until now() reaches time
+void sleep_until(int64_t time);
+
+// Frames start at absolute deadlines one period apart, so rounding and the
+// time spent in a frame never accumulate into drift. The frame timer fires
+// spin nanoseconds before each deadline and the rest is busy-waited, for
+// frame starts closer to the deadline than the kernel timer slack allows.
+struct FrameScheduler {
+  int64_t period;
+  int64_t spin;
+  int64_t deadline;
+  // Lateness of frame starts after their deadline since the last reset. When
+  // the timer expired more than once the frames in between were missed.
+  int64_t wakeups;
+  int64_t total_lateness;
+  int64_t maximum_lateness;
+  int64_t missed_deadlines;
+};
+
+void init_frame_scheduler(struct FrameScheduler *s, int64_t period,
+                          int64_t spin);
+// when the frame timer has to fire first, it then fires every period
+int64_t first_frame_tick(struct FrameScheduler *s);
+// Starts a frame after the frame timer expired ticks times and returns how
+// late it started.
+int64_t start_frame(struct FrameScheduler *s, uint64_t ticks);
+int64_t average_lateness(struct FrameScheduler *s);
+void reset_lateness(struct FrameScheduler *s);
 #endif
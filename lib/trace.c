@@ -0,0 +1,249 @@
+#include "trace.h"
+#include "events.h"
+#include "timing.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// events per thread, a power of two
+#define TRACE_RING_SIZE (1 << 15)
+#define TRACE_THREADS 4
+#define TRACE_WRITE_INTERVAL (10 * NANOSECONDS_PER_MILLISECOND)
+#define TRACE_FILE_BUFFER_SIZE (1 << 20)
+
+struct TraceEvent {
+  const char *name;
+  int64_t time;
+  // the duration of a span, the value of a counter
+  int64_t value;
+  // Chrome trace event type, 'X' for spans, 'i' for instants and 'C' for
+  // counters
+  char type;
+};
+
+// Recorded into by one thread and read by the writer. head and tail count
+// events and only grow, an event is at its count modulo TRACE_RING_SIZE.
+struct TraceRing {
+  struct TraceEvent events[TRACE_RING_SIZE];
+  atomic_uint head;
+  atomic_uint tail;
+  atomic_uint dropped;
+  const char *thread_name;
+  atomic_bool named;
+  bool name_written;
+};
+
+atomic_bool tracing;
+atomic_bool trace_stopping;
+// The rings stay allocated after stop_trace, another thread may still be
+// recording into its ring.
+struct TraceRing *trace_rings;
+atomic_uint trace_ring_count;
+_Thread_local struct TraceRing *thread_ring;
+_Thread_local bool thread_ring_claimed;
+
+FILE *trace_file;
+char *trace_file_buffer;
+pthread_t trace_writer;
+// timestamps in the file are relative to start_trace
+int64_t trace_origin;
+bool trace_events_written;
+
+///////////////
+// Recording //
+///////////////
+
+struct TraceRing *claim_ring(void) {
+  if (!thread_ring_claimed) {
+    thread_ring_claimed = true;
+    unsigned int index = atomic_fetch_add(&trace_ring_count, 1);
+    if (index < TRACE_THREADS) {
+      thread_ring = &trace_rings[index];
+    }
+  }
+  return thread_ring;
+}
+
+void record(char type, const char *name, int64_t time, int64_t value) {
+  if (!atomic_load_explicit(&tracing, memory_order_relaxed)) {
+    return;
+  }
+  struct TraceRing *ring = claim_ring();
+  if (!ring) {
+    return;
+  }
+
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail == TRACE_RING_SIZE) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  ring->events[head % TRACE_RING_SIZE] =
+      (struct TraceEvent){name, time, value, type};
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void trace_thread_name(const char *name) {
+  if (!atomic_load(&tracing)) {
+    return;
+  }
+  struct TraceRing *ring = claim_ring();
+  if (ring) {
+    ring->thread_name = name;
+    atomic_store_explicit(&ring->named, true, memory_order_release);
+  }
+}
+
+void trace_span(const char *name, int64_t start, int64_t end) {
+  record('X', name, start, end - start);
+}
+
+void trace_instant(const char *name, int64_t time) {
+  record('i', name, time, 0);
+}
+
+void trace_counter(const char *name, int64_t time, int64_t value) {
+  record('C', name, time, value);
+}
+
+/////////////
+// Writing //
+/////////////
+
+// Chrome traces count in microseconds, the fraction keeps the nanoseconds.
+void write_microseconds(int64_t nanoseconds) {
+  if (nanoseconds < 0) {
+    fputc('-', trace_file);
+    nanoseconds = -nanoseconds;
+  }
+  fprintf(trace_file, "%" PRId64 ".%03d", nanoseconds / 1000,
+          (int)(nanoseconds % 1000));
+}
+
+void start_trace_event(void) {
+  fputs(trace_events_written ? ",\n" : "\n", trace_file);
+  trace_events_written = true;
+}
+
+void write_trace_event(int thread, struct TraceEvent *e) {
+  start_trace_event();
+  fprintf(trace_file, "{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d",
+          e->name, e->type, thread);
+  fputs(",\"ts\":", trace_file);
+  write_microseconds(e->time - trace_origin);
+  switch (e->type) {
+  case 'X':
+    fputs(",\"dur\":", trace_file);
+    write_microseconds(e->value);
+    break;
+  case 'i':
+    fputs(",\"s\":\"t\"", trace_file);
+    break;
+  case 'C':
+    fprintf(trace_file, ",\"args\":{\"value\":%" PRId64 "}", e->value);
+    break;
+  }
+  fputc('}', trace_file);
+}
+
+void write_trace_rings(void) {
+  unsigned int count = atomic_load(&trace_ring_count);
+  count = count < TRACE_THREADS ? count : TRACE_THREADS;
+  for (unsigned int i = 0; i < count; i++) {
+    struct TraceRing *ring = &trace_rings[i];
+    int thread = i + 1;
+    if (!ring->name_written &&
+        atomic_load_explicit(&ring->named, memory_order_acquire)) {
+      start_trace_event();
+      fprintf(trace_file,
+              "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+              "\"args\":{\"name\":\"%s\"}}",
+              thread, ring->thread_name);
+      ring->name_written = true;
+    }
+
+    unsigned int tail, head;
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; tail++) {
+      write_trace_event(thread, &ring->events[tail % TRACE_RING_SIZE]);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+}
+
+void *trace_writer_loop(void *argument) {
+  (void)argument;
+  struct timespec interval = nanoseconds_to_timespec(TRACE_WRITE_INTERVAL);
+  while (!atomic_load(&trace_stopping)) {
+    nanosleep(&interval, NULL);
+    write_trace_rings();
+  }
+  return NULL;
+}
+
+////////////////
+// Public Api //
+////////////////
+
+void free_trace(void) {
+  if (trace_file) {
+    fclose(trace_file);
+    trace_file = NULL;
+  }
+  free(trace_file_buffer);
+  trace_file_buffer = NULL;
+}
+
+bool start_trace(const char *path) {
+  trace_rings = calloc(TRACE_THREADS, sizeof(struct TraceRing));
+  trace_file_buffer = malloc(TRACE_FILE_BUFFER_SIZE);
+  trace_file = fopen(path, "w");
+  if (!trace_rings || !trace_file_buffer || !trace_file) {
+    free_trace();
+    free(trace_rings);
+    trace_rings = NULL;
+    return false;
+  }
+  setvbuf(trace_file, trace_file_buffer, _IOFBF, TRACE_FILE_BUFFER_SIZE);
+  fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", trace_file);
+  trace_origin = now();
+
+  if (start_thread(&trace_writer, trace_writer_loop) != 0) {
+    free_trace();
+    free(trace_rings);
+    trace_rings = NULL;
+    return false;
+  }
+
+  atomic_store(&tracing, true);
+  atexit(stop_trace);
+  return true;
+}
+
+void stop_trace(void) {
+  if (!atomic_exchange(&tracing, false)) {
+    return;
+  }
+  atomic_store(&trace_stopping, true);
+  pthread_join(trace_writer, NULL);
+  write_trace_rings();
+
+  // events lost to full rings show up as a counter at the end of each thread
+  int64_t end = now();
+  unsigned int count = atomic_load(&trace_ring_count);
+  count = count < TRACE_THREADS ? count : TRACE_THREADS;
+  for (unsigned int i = 0; i < count; i++) {
+    unsigned int dropped = atomic_load(&trace_rings[i].dropped);
+    if (dropped > 0) {
+      struct TraceEvent e = {"dropped trace events", end, dropped, 'C'};
+      write_trace_event(i + 1, &e);
+    }
+  }
+
+  fputs("\n]}\n", trace_file);
+  free_trace();
+}
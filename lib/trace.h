@@ -0,0 +1,27 @@
+#ifndef trace_h
+#define trace_h
+#include <stdbool.h>
+#include <stdint.h>
+
+// Optional tracing into a Chrome Trace Event JSON file, which Perfetto and
+// chrome://tracing load. Each thread records into its own preallocated ring
+// without locks or system calls, a background thread writes the rings out.
+// Events that do not fit into a full ring are dropped and counted. Without a
+// call to start_trace, recording returns right away.
+//
+// Timestamps are CLOCK_MONOTONIC nanoseconds, see now(). Names are not
+// copied, they have to stay valid until stop_trace, e.g. string literals.
+
+// Returns false when the file or the writer thread could not be created.
+bool start_trace(const char *path);
+// Writes what is left and closes the file, start_trace registers it with
+// atexit.
+void stop_trace(void);
+
+// Names the calling thread in the trace.
+void trace_thread_name(const char *name);
+void trace_span(const char *name, int64_t start, int64_t end);
+void trace_instant(const char *name, int64_t time);
+void trace_counter(const char *name, int64_t time, int64_t value);
+
+#endif
@@ -1,7 +1,11 @@
+#include "lib/cast.h"
+#include "lib/events.h"
 #include "lib/frame_info.h"
+#include "lib/input.h"
+#include "lib/session.h"
 #include "lib/terminalio.h"
 #include "lib/timing.h"
-#include <ctype.h>
+#include "lib/trace.h"
 #include <fcntl.h>
 #include <inttypes.h>
 #include <locale.h>
@@ -9,28 +13,44 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
 
+// The game advances in fixed ticks, independent of how often it is rendered.
+// The render rate is a whole number of ticks per frame, it can not exceed the
+// tick rate since nothing changes in between.
+#define TICK_RATE 120
+#define TICK_TIME (NANOSECONDS_PER_SECOND / TICK_RATE)
+// ticks beyond this after a stall are dropped instead of simulated at once
+#define MAX_CATCH_UP_TICKS 12
 #define FPS 60
-#define FRAME_TIME (1000 / FPS)
+#define MIN_FPS 15
 #define RECENT_FRAMES_SIZE FPS * 10
-
-#define INPUT_BUFFER_SIZE 20
+// busy-waited before each tick with --spin
+#define SPIN_TIME (250 * NANOSECONDS_PER_MICROSECOND)
+// --fps auto renders less often after frames were dropped within a second,
+// and goes back up after this many seconds without drops
+#define ADAPTIVE_RECOVERY_SECONDS 3
+
+// one read of the terminal, at most SESSION_INPUT_SIZE so that it is recorded
+// as one chunk
+#define INPUT_BUFFER_SIZE SESSION_INPUT_SIZE
+#define MOVE_QUEUE_SIZE 20
 #define INPUT_CHAIN_SIZE 6
 #define COMMAND_CHAIN 10
 #define GAME_WIDTH 40
 #define GAME_HEIGHT 20
+#define HUD_WIDTH 14
+// a title, one line per phase and one per render counter
+#define PROFILE_LINES (1 + PHASE_COUNT + 6)
 
 #define UP 0
 #define DOWN 1
 #define LEFT 2
 #define RIGHT 3
 
-#define CTRL_KEY(k) ((k) & 0x1f)
-#define ESC 27
-
 #define SMILING_FACE "\xE2\x98\xBB\0"
 #define SQUARE "\xE2\x96\xA0\0"
 
@@ -51,9 +71,27 @@ struct Vector screen_size;
 
 struct FrameInfo recent_frames_data[RECENT_FRAMES_SIZE];
 struct FrameInfoBuffer frame_info;
+struct FrameScheduler scheduler;
+
+uint64_t tick;
+uint64_t next_render_tick;
+unsigned int ticks_per_frame = TICK_RATE / FPS;
+unsigned int target_ticks_per_frame = TICK_RATE / FPS;
+bool adaptive_fps = false;
 
 char input_buffer[INPUT_BUFFER_SIZE];
 char last_input[INPUT_BUFFER_SIZE];
+struct InputDecoder input_decoder;
+
+// With --replay, input and resizes come from a session log instead of the
+// terminal, one tick after another in the recorded batches, at the recorded
+// pace or with --fast as fast as possible.
+bool replaying = false;
+bool replay_fast = false;
+int64_t replay_start;
+struct SessionRecord replay_record;
+// replay_record was read and is still to be handled
+bool replay_record_pending = false;
 
 //////////////////////////////
 // TERMINAL AND IO SETTINGS //
@@ -62,11 +100,130 @@ char last_input[INPUT_BUFFER_SIZE];
 ///////////////////////////////////////////////
 
 char input_chain[INPUT_CHAIN_SIZE];
+uint8_t input_chain_length;
+
+// HUD text is only formatted again when its value changed
+struct Text fps_text;
+// p50, p95, p99 and the maximum of the recent frame times
+#define FRAME_TIME_PERCENTILES 4
+const int frame_time_per_mille[FRAME_TIME_PERCENTILES] = {500, 950, 990, 1000};
+struct Text frame_time_texts[FRAME_TIME_PERCENTILES];
+struct Text dropped_text;
+struct Text coalesced_text;
+struct Text jitter_text;
+struct Text render_fps_text;
+struct Text render_load_text;
+
+void init_frame_info_texts(void) {
+  int x = get_max_x() - HUD_WIDTH;
+  init_text(&fps_text, LAYER_HUD, x, 0, default_style(), "FPS : %ld");
+  init_text(&frame_time_texts[0], LAYER_HUD, x, 1, default_style(),
+            "p50 : %ldus");
+  init_text(&frame_time_texts[1], LAYER_HUD, x, 2, default_style(),
+            "p95 : %ldus");
+  init_text(&frame_time_texts[2], LAYER_HUD, x, 3, default_style(),
+            "p99 : %ldus");
+  init_text(&frame_time_texts[3], LAYER_HUD, x, 4, default_style(),
+            "max : %ldus");
+  init_text(&dropped_text, LAYER_HUD, x, 5, default_style(), "Drop: %ld");
+  init_text(&coalesced_text, LAYER_HUD, x, 6, default_style(), "Coal: %ld");
+  init_text(&jitter_text, LAYER_HUD, x, 7, default_style(), "Jit : %ldus");
+  init_text(&render_fps_text, LAYER_HUD, x, 8, default_style(), "RFPS: %ld");
+  init_text(&render_load_text, LAYER_HUD, x, 9, default_style(),
+            "Draw: %ld%%");
+}
+
+// The profiler overlay, toggled with 'p', shows where the time of an average
+// frame goes and how much the renderer wrote for it.
+bool profiler_visible = false;
+struct Text profile_texts[PROFILE_LINES];
+
+void init_profile_texts(void) {
+  for (int i = 0; i < PROFILE_LINES; i++) {
+    init_text(&profile_texts[i], LAYER_HUD, 0, i, default_style(), "");
+  }
+}
+
+void print_profile(void) {
+  // timings differ from run to run, a replay leaves them out so that it
+  // renders the same bytes every time
+  if (replaying) {
+    return;
+  }
+  struct FrameInfo average;
+  if (!average_frame_profile(&frame_info, &average)) {
+    return;
+  }
+  // with a render thread, only compositing is done by the main loop
+  struct FrameInfo render_average;
+  if (render_thread_profile(&render_average)) {
+    add_frame_profile(&average, &render_average);
+  }
+
+  char line[TEXT_SIZE];
+  struct Text *text = profile_texts;
+  set_text(text++, "Profile   us/frame");
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    snprintf(line, sizeof(line), "%-9s %8" PRId64, phase_name(phase),
+             (int64_t)(average.phases[phase] / NANOSECONDS_PER_MICROSECOND));
+    set_text(text++, line);
+  }
+
+  struct RenderCounters *c = &average.counters;
+  const char *names[] = {"diffed", "emitted", "moves", "sgr", "bytes",
+                         "writes"};
+  uint32_t values[] = {c->cells_diffed, c->cells_emitted, c->cursor_moves,
+                       c->sgr_changes,  c->bytes_written, c->write_calls};
+  for (int i = 0; i < 6; i++) {
+    snprintf(line, sizeof(line), "%-9s %8" PRIu32, names[i], values[i]);
+    set_text(text++, line);
+  }
+}
+
+void hide_profile(void) {
+  for (int i = 0; i < PROFILE_LINES; i++) {
+    set_text(&profile_texts[i], "");
+  }
+}
+
+int64_t frame_time(void) { return ticks_per_frame * TICK_TIME; }
 
 void print_frame_info(void) {
-  draw_string(get_max_x() - 10, 1, "Load: %d%%",
-              average_active_time(&frame_info) / FRAME_TIME * 100);
-  draw_string(get_max_x() - 10, 0, "FPS : %d", average_fps(&frame_info));
+  if (replaying) {
+    return;
+  }
+  set_text_value(&fps_text, average_fps(&frame_info));
+
+  unsigned int dropped, coalesced;
+  frame_drop_stats(&dropped, &coalesced);
+  set_text_value(&dropped_text, dropped);
+  set_text_value(&coalesced_text, coalesced);
+
+  // average lateness of the tick wakeups and frame time percentiles of the
+  // recent frames, once a second
+  if (scheduler.wakeups >= TICK_RATE) {
+    set_text_value(&jitter_text,
+                   average_lateness(&scheduler) / NANOSECONDS_PER_MICROSECOND);
+    reset_lateness(&scheduler);
+
+    int64_t frame_times[FRAME_TIME_PERCENTILES];
+    if (active_time_percentiles(&frame_info, frame_time_per_mille,
+                                frame_times, FRAME_TIME_PERCENTILES)) {
+      for (int i = 0; i < FRAME_TIME_PERCENTILES; i++) {
+        set_text_value(&frame_time_texts[i],
+                       frame_times[i] / NANOSECONDS_PER_MICROSECOND);
+      }
+    }
+  }
+
+  // with a render thread, Load only covers the simulation
+  int render_fps;
+  int64_t render_active_time;
+  if (render_thread_stats(&render_fps, &render_active_time)) {
+    set_text_value(&render_load_text,
+                   render_active_time * 100 / frame_time());
+    set_text_value(&render_fps_text, render_fps);
+  }
 }
 
 ////////////////
@@ -75,11 +232,16 @@ void print_frame_info(void) {
 
 bool exited = false;
 bool command_mode = false;
+bool overlay_visible = false;
 struct Vector level_size = {GAME_WIDTH, GAME_HEIGHT};
 struct Vector game_offset;
 
 struct Drawable player;
 
+// moves read since the last tick, applied by the next one
+uint8_t queued_moves[MOVE_QUEUE_SIZE];
+uint8_t queued_moves_count;
+
 bool set_game_offset(void) {
   if (level_size.x * 2 > screen_size.x || level_size.y > screen_size.y) {
     return false;
@@ -147,76 +309,137 @@ bool try_player_move(struct Vector vector) {
 }
 
 void add_to_input_chain(char c) {
-  if (strlen(input_chain) >= INPUT_CHAIN_SIZE - 1) {
-    for (uint8_t i = 0; i < strlen(input_chain); i++) {
-      input_chain[i] = input_chain[i + 1];
-    }
+  if (input_chain_length >= INPUT_CHAIN_SIZE - 1) {
+    memmove(input_chain, input_chain + 1, input_chain_length--);
   }
+  input_chain[input_chain_length++] = c;
+  input_chain[input_chain_length] = '\0';
+}
 
-  uint8_t length = strlen(input_chain);
-  input_chain[length] = c;
-  input_chain[length + 1] = '\0';
+void clear_input_chain(void) {
+  input_chain[0] = '\0';
+  input_chain_length = 0;
 }
 
-void clear_input_chain(void) { input_chain[0] = '\0'; }
+void queue_move(uint8_t direction) {
+  if (queued_moves_count < sizeof(queued_moves)) {
+    queued_moves[queued_moves_count++] = direction;
+  }
+}
 
-void process_input(void) {
-  for (ssize_t i = 0; input_buffer[i] != '\0'; i++) {
-    if (isdigit(input_buffer[i])) {
-      add_to_input_chain(input_buffer[i]);
-    } else {
-      switch (input_buffer[i]) {
-      case 'h':
-        try_player_move(vector_from_direction(LEFT, 1));
-        break;
-      case 'j':
-        try_player_move(vector_from_direction(DOWN, 1));
-        break;
-      case 'k':
-        try_player_move(vector_from_direction(UP, 1));
-        break;
-      case 'l':
-        try_player_move(vector_from_direction(RIGHT, 1));
-        break;
-      case ':':
-        command_mode = true;
-        break;
-      case ESC: // escape char
-        switch (input_buffer[i + 1]) {
-        case '[':
-          break;
-        default: // ESC pressed
-          clear_input_chain();
-          break;
-        }
-      }
-    }
+// Advances the game by one tick, returns whether anything changed.
+bool update_game(void) {
+  bool changed = false;
+  for (uint8_t i = 0; i < queued_moves_count; i++) {
+    changed |= try_player_move(vector_from_direction(queued_moves[i], 1));
   }
+  queued_moves_count = 0;
+  return changed;
 }
 
-void process_command_input(void) {
-  for (ssize_t i = 0; input_buffer[i] != '\0'; i++) {
-    switch (input_buffer[i]) {
-    case 'q':
-      exited = true;
-      break;
-    case 'r':
-      // TODO:
-      // set_screen_size();
-      break;
-    case ESC: // escape char
-      switch (input_buffer[i + 1]) {
-      case '[':
-        break;
-      default: // ESC pressed
-        command_mode = false;
-        break;
-      }
+void toggle_profiler(void) {
+  profiler_visible = !profiler_visible;
+  if (profiler_visible) {
+    print_profile();
+  } else {
+    hide_profile();
+  }
+}
+
+// pasted text is not taken for commands
+void process_key(struct KeyEvent *event) {
+  if (event->pasted) {
+    return;
+  }
+  switch (event->key) {
+  case KEY_LEFT:
+    queue_move(LEFT);
+    return;
+  case KEY_DOWN:
+    queue_move(DOWN);
+    return;
+  case KEY_UP:
+    queue_move(UP);
+    return;
+  case KEY_RIGHT:
+    queue_move(RIGHT);
+    return;
+  case KEY_ESCAPE:
+    clear_input_chain();
+    return;
+  default:
+    break;
+  }
+  if (event->key != KEY_CHARACTER || event->modifiers != 0) {
+    return;
+  }
+
+  if (event->codepoint >= '0' && event->codepoint <= '9') {
+    add_to_input_chain(event->codepoint);
+    return;
+  }
+  switch (event->codepoint) {
+  case 'h':
+    queue_move(LEFT);
+    break;
+  case 'j':
+    queue_move(DOWN);
+    break;
+  case 'k':
+    queue_move(UP);
+    break;
+  case 'l':
+    queue_move(RIGHT);
+    break;
+  case ':':
+    command_mode = true;
+    break;
+  case 'p':
+    toggle_profiler();
+    break;
+  }
+}
+
+void process_command_key(struct KeyEvent *event) {
+  if (event->pasted) {
+    return;
+  }
+  if (event->key == KEY_ESCAPE) {
+    command_mode = false;
+    return;
+  }
+  if (event->key != KEY_CHARACTER || event->modifiers != 0) {
+    return;
+  }
+  switch (event->codepoint) {
+  case 'q':
+    exited = true;
+    break;
+  case 'r':
+    // TODO:
+    // set_screen_size();
+    break;
+  }
+}
+
+// Handles the keys decoded so far. Times are counted in ticks, so a replay
+// tells a lone ESC from the start of a sequence just like the recording did.
+void process_input(void) {
+  struct KeyEvent event;
+  while (!exited &&
+         next_key_event(&input_decoder, tick * TICK_TIME, &event)) {
+    if (command_mode) {
+      process_command_key(&event);
+    } else {
+      process_key(&event);
     }
   }
 }
 
+// draws the pause menu into the overlay layer, where it stays until it is
+// cleared when command mode is left
 void print_command_mode_info(void) {
+  select_layer(LAYER_OVERLAY);
   int height = get_max_y() / 2;
   int width = get_max_x() / 2;
   int top = get_max_y() / 2 - height / 2;
@@ -235,6 +458,7 @@ void print_command_mode_info(void) {
   draw_sstring(left + (width - 14) / 2, top + 3, style, "  r: resize screen");
   draw_sstring(left + (width - 14) / 2, top + 4, style, "  q:    quit");
   draw_sstring(left + (width - 14) / 2, top + 5, style, "ESC:  continue");
+  select_layer(LAYER_ENTITIES);
 }
 
 // void print_input_info(void) {
@@ -258,45 +482,337 @@ void print_command_mode_info(void) {
 //   printf("Chain: %s", input_chain);
 // }
 
-int main(void) {
+void draw_frame(void) {
+  int64_t mark = now();
+  // retained layers were cleared by a resize
+  bool resized = screen_resized();
+  if (resized) {
+    init_frame_info_texts();
+    init_profile_texts();
+    if (profiler_visible) {
+      print_profile();
+    }
+  }
+
+  draw_display(player.position.x, player.position.y, player.display);
+
+  if (command_mode && (!overlay_visible || resized)) {
+    print_command_mode_info();
+    overlay_visible = true;
+  } else if (!command_mode && overlay_visible) {
+    clear_layer(LAYER_OVERLAY);
+    overlay_visible = false;
+  }
+
+  print_frame_info();
+  // print_input_info();
+
+  end_phase(frame_info.current_frame, PHASE_DRAW, &mark);
+  render_frame();
+  take_render_profile(frame_info.current_frame);
+}
+
+// Picks the render rate for --fps auto once per second: half as often after
+// the terminal dropped frames, back towards the target once it keeps up.
+void adapt_render_rate(void) {
+  static unsigned int last_dropped;
+  static unsigned int quiet_seconds;
+
+  unsigned int dropped, coalesced;
+  frame_drop_stats(&dropped, &coalesced);
+  if (dropped != last_dropped) {
+    quiet_seconds = 0;
+    if (ticks_per_frame * 2 <= TICK_RATE / MIN_FPS) {
+      ticks_per_frame *= 2;
+    }
+  } else if (++quiet_seconds >= ADAPTIVE_RECOVERY_SECONDS &&
+             ticks_per_frame > target_ticks_per_frame) {
+    quiet_seconds = 0;
+    ticks_per_frame /= 2;
+  }
+  last_dropped = dropped;
+}
+
+// Sets the render rate, rounded to a whole number of ticks per frame.
+bool set_render_rate(const char *fps) {
+  if (strcmp(fps, "auto") == 0) {
+    adaptive_fps = true;
+    return true;
+  }
+
+  int rate = atoi(fps);
+  if (rate <= 0) {
+    return false;
+  }
+  rate = rate > TICK_RATE ? TICK_RATE : rate;
+  ticks_per_frame = (TICK_RATE + rate / 2) / rate;
+  target_ticks_per_frame = ticks_per_frame;
+  return true;
+}
+
+/////////////////////////////
+// Recording and Replaying //
+/////////////////////////////
+
+// waits until time after the start of the replay, unless it runs --fast
+void wait_for_replay(int64_t time) {
+  if (!replay_fast) {
+    sleep_until(replay_start + time);
+  }
+}
+
+// Stands in for wait_for_events during a replay. The records of the current
+// tick are handled one by one before the tick advances, which keeps a replay
+// independent of how the recorded frames were timed.
+unsigned int replay_events(void) {
+  if (!replay_record_pending) {
+    replay_record_pending = next_session_record(&replay_record);
+    if (!replay_record_pending) {
+      return EVENT_TERMINATE;
+    }
+  }
+
+  if (replay_record.tick <= tick) {
+    wait_for_replay(replay_record.time);
+    switch (replay_record.type) {
+    case SESSION_INPUT:
+      return EVENT_INPUT;
+    case SESSION_RESIZE:
+      return EVENT_RESIZE;
+    case SESSION_TICKS:
+      return EVENT_FRAME;
+    }
+  }
+  wait_for_replay((tick + 1) * TICK_TIME);
+  return EVENT_FRAME;
+}
+
+// Ticks of the frame event replay_events returned, those of a recorded batch
+// or else one.
+uint64_t replay_ticks(void) {
+  if (replay_record_pending && replay_record.type == SESSION_TICKS &&
+      replay_record.tick <= tick) {
+    replay_record_pending = false;
+    return replay_record.ticks;
+  }
+  return 1;
+}
+
+// Reads until the terminal has nothing more or the decoder is full, what is
+// left is read once the decoder caught up. Each read is recorded on its own.
+void read_next_input(void) {
+  if (replaying) {
+    feed_input(&input_decoder, replay_record.input, replay_record.length);
+    replay_record_pending = false;
+    return;
+  }
+
+  unsigned int space, length;
+  while ((space = input_space(&input_decoder)) > 0) {
+    // read_input leaves room for a NUL
+    if (space > INPUT_BUFFER_SIZE - 1) {
+      space = INPUT_BUFFER_SIZE - 1;
+    }
+    length = read_input(input_buffer, space + 1);
+    if (length == 0) {
+      break;
+    }
+    record_input(tick, input_buffer, length);
+    feed_input(&input_decoder, input_buffer, length);
+  }
+}
+
+void resize_screen(void) {
+  if (replaying) {
+    resize_headless(replay_record.rows, replay_record.cols);
+    replay_record_pending = false;
+  } else {
+    update_screen_size();
+  }
+  record_resize(tick, get_max_y(), get_max_x());
+  cast_resize(get_max_y(), get_max_x());
+}
+
+// Renders the session of the log headless to stdout, at the recorded screen
+// sizes with the recorded terminfo entry.
+bool start_replaying(const char *path) {
+  struct SessionHeader header;
+  if (!start_replay(path, &header)) {
+    fprintf(stderr, "Could not read the session log %s.\n", path);
+    return false;
+  }
+  setenv("TERM", header.term, 1);
+  if (!init_terminalio_headless(header.rows, header.cols)) {
+    return false;
+  }
+  disable_frame_drops();
+  replaying = true;
+  replay_start = now();
+  return true;
+}
+
+void start_recording_session(const char *path) {
+  struct SessionHeader header;
+  const char *term = getenv("TERM");
+  snprintf(header.term, sizeof(header.term), "%s", term ? term : "");
+  header.rows = get_max_y();
+  header.cols = get_max_x();
+  if (!start_recording(path, &header)) {
+    fprintf(stderr, "Could not record to %s.\n", path);
+  }
+}
+
+int main(int argc, char **argv) {
+  bool render_thread = false;
+  int64_t spin = 0;
+  const char *trace_path = NULL;
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  const char *cast_path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--render-thread") == 0) {
+      render_thread = true;
+    } else if (strcmp(argv[i], "--spin") == 0) {
+      spin = SPIN_TIME;
+    } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc &&
+               set_render_rate(argv[i + 1])) {
+      i++;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (strcmp(argv[i], "--fast") == 0) {
+      replay_fast = true;
+    } else if (strcmp(argv[i], "--cast") == 0 && i + 1 < argc) {
+      cast_path = argv[++i];
+    } else {
+      fprintf(stderr,
+              "usage: %s [--render-thread] [--spin] [--fps <rate>|auto] "
+              "[--trace <file>] [--record <file>] [--replay <file> "
+              "[--fast]] [--cast <file>]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  // the render thread presents frames whenever it gets to them, a replay
+  // would no longer write the same bytes every time
+  if (replay_path && render_thread) {
+    fprintf(stderr, "%s: --replay can not be used with --render-thread\n",
+            argv[0]);
+    return 1;
+  }
 
   // TODO: this in terminalio?
   setlocale(LC_ALL, "");
-  init_terminalio();
+  // before the terminal is set up, so its setup is recorded too
+  if (cast_path && !start_cast(cast_path)) {
+    fprintf(stderr, "Could not record to %s.\n", cast_path);
+  }
+  if (!replay_path) {
+    init_terminalio();
+  } else if (!start_replaying(replay_path)) {
+    return 1;
+  }
+  if (record_path) {
+    start_recording_session(record_path);
+  }
+  cast_resize(get_max_y(), get_max_x());
+  // before the render thread, so it is stopped before the trace is closed
+  if (trace_path && !start_trace(trace_path)) {
+    fprintf(stderr, "Could not start tracing to %s.\n", trace_path);
+  }
+  trace_thread_name("main");
+  if (render_thread && !start_render_thread()) {
+    fprintf(stderr, "Could not start the render thread.\n");
+  }
 
   player.position.x = GAME_WIDTH / 2;
   player.position.y = GAME_HEIGHT / 2;
   player.display = (struct Display){
       SQUARE, color_style(color_rgb(255, 23, 46), default_color())};
 
+  init_input_decoder(&input_decoder);
   frame_info =
       initialize_frame_info_buffer(recent_frames_data, RECENT_FRAMES_SIZE);
+  init_frame_info_texts();
+  init_profile_texts();
+  init_frame_scheduler(&scheduler, TICK_TIME, spin);
+  if (!replaying && !init_events(first_frame_tick(&scheduler), TICK_TIME)) {
+    fprintf(stderr, "Could not set up the event loop.\n");
+    return 1;
+  }
 
   while (!exited) {
-    frame_info.current_frame->start = now();
-    read_input(input_buffer, sizeof(input_buffer));
-
-    if (command_mode) {
-      process_command_input();
-    } else {
-      process_input();
+    unsigned int events = replaying ? replay_events() : wait_for_events();
+    if (events & EVENT_TERMINATE) {
+      break;
     }
 
-    draw_display(player.position.x, player.position.y, player.display);
-
-    if (command_mode) {
-      print_command_mode_info();
+    // resizes and menu changes show up right away, moves with the next tick
+    bool redraw = false;
+    if (events & EVENT_RESIZE) {
+      trace_instant("resize event", now());
+      resize_screen();
+      redraw = true;
     }
 
-    print_frame_info();
-    // print_input_info();
+    int64_t mark = now();
+    // a pending ESC becomes a key of its own once nothing followed in time
+    if ((events & EVENT_INPUT) || input_pending(&input_decoder)) {
+      if (events & EVENT_INPUT) {
+        trace_instant("input event", mark);
+        read_next_input();
+      }
+      bool was_command_mode = command_mode;
+      process_input();
+      redraw |= command_mode != was_command_mode;
+      end_phase(frame_info.current_frame, PHASE_INPUT, &mark);
+    }
 
-    render_frame();
+    if (events & EVENT_FRAME) {
+      uint64_t ticks;
+      if (replaying) {
+        ticks = replay_ticks();
+      } else {
+        ticks = frame_ticks();
+        trace_counter("tick lateness", mark, start_frame(&scheduler, ticks));
+        trace_counter("ticks missed", mark, ticks - 1);
+        // a lone ESC times out between batches, a replay has to run the same
+        if (ticks != 1) {
+          record_ticks(tick, ticks);
+        }
+      }
+      if (ticks > MAX_CATCH_UP_TICKS) {
+        tick += ticks - MAX_CATCH_UP_TICKS;
+        ticks = MAX_CATCH_UP_TICKS;
+      }
+      for (uint64_t i = 0; i < ticks; i++) {
+        redraw |= update_game();
+        if (++tick % TICK_RATE == 0) {
+          if (adaptive_fps) {
+            adapt_render_rate();
+          }
+          if (profiler_visible) {
+            print_profile();
+          }
+        }
+      }
+      end_phase(frame_info.current_frame, PHASE_UPDATE, &mark);
+    }
 
-    // Frame end
+    if (exited || (!redraw && tick < next_render_tick)) {
+      continue;
+    }
+    frame_info.current_frame->start = now();
+    draw_frame();
     frame_info.current_frame->end = now();
-    wait(until_end_of_frame(frame_info.current_frame->start, FRAME_TIME));
+    trace_span("frame", frame_info.current_frame->start,
+               frame_info.current_frame->end);
     advance_frame_info_buffer(&frame_info);
+    next_render_tick = tick + ticks_per_frame;
   }
 
   return 0;
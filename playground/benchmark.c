@@ -0,0 +1,164 @@
+#include "../lib/output.h"
+#include "../lib/terminalio.h"
+#include "benchmark_scenarios.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Runs the benchmark scenarios on terminalio without a terminal. Output goes
+// to memory, or with --pty through a pty that is read as fast as possible.
+// --compare runs the ncurses benchmark with the same arguments and prints
+// both side by side.
+//
+// gcc -O2 playground/benchmark.c playground/benchmark_scenarios.c lib/*.c
+//     -lunibilium -pthread -o benchmark
+
+#define DEFAULT_ROWS 50
+#define DEFAULT_COLS 200
+#define DEFAULT_FRAMES 600
+#define DEFAULT_TERM "xterm-256color"
+#define COMMAND_SIZE 512
+
+int pty_fd = -1;
+
+const enum Layer benchmark_layers[] = {
+    [BENCHMARK_BACKGROUND] = LAYER_LEVEL,
+    [BENCHMARK_HUD] = LAYER_HUD,
+    [BENCHMARK_OVERLAY] = LAYER_OVERLAY,
+};
+
+void clear_layers(void) {
+  clear_layer(LAYER_LEVEL);
+  clear_layer(LAYER_HUD);
+  clear_layer(LAYER_OVERLAY);
+}
+
+void draw(int x, int y, char character, struct Rgb color,
+          struct Rgb background, enum BenchmarkLayer layer) {
+  select_layer(benchmark_layers[layer]);
+  struct Display d = {{character, '\0'},
+                      color_style(color_rgb(color.red, color.green, color.blue),
+                                  color_rgb(background.red, background.green,
+                                            background.blue))};
+  draw_display(x, y, d);
+}
+
+void close_overlay(void) { clear_layer(LAYER_OVERLAY); }
+
+void resize(int rows, int cols) {
+  if (pty_fd >= 0) {
+    resize_pty(pty_fd, rows, cols);
+  }
+  resize_headless(rows, cols);
+}
+
+void discard_output(const char *bytes, size_t length, void *context) {
+  (void)bytes;
+  (void)length;
+  (void)context;
+}
+
+struct BenchmarkBackend terminalio_backend = {
+    "terminalio", clear_layers, draw,         close_overlay,
+    render_frame, resize,       output_stats,
+};
+
+// Runs the ncurses benchmark and prints its results next to ours.
+void compare(const char *command, struct ScenarioResult *results) {
+  FILE *f = popen(command, "r");
+  if (!f) {
+    fprintf(stderr, "Could not run %s\n", command);
+    return;
+  }
+
+  printf("\n%-8s %21s %21s %15s\n", "", "ns/frame", "bytes/frame",
+         "writes/frame");
+  printf("%-8s %10s %10s %10s %10s %7s %7s\n", "scenario", "terminalio",
+         "ncurses", "terminalio", "ncurses", "tio", "nc");
+  char line[256], name[32];
+  struct ScenarioResult theirs;
+  while (fgets(line, sizeof(line), f)) {
+    if (!parse_result(line, name, sizeof(name), &theirs)) {
+      continue;
+    }
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+      if (strcmp(get_scenario(i)->name, name) != 0) {
+        continue;
+      }
+      struct ScenarioResult *ours = &results[i];
+      printf("%-8s %10ld %10ld %10.1f %10.1f %7.2f %7.2f\n", name,
+             (long)ours->nanoseconds_per_frame,
+             (long)theirs.nanoseconds_per_frame, ours->bytes_per_frame,
+             theirs.bytes_per_frame, ours->writes_per_frame,
+             theirs.writes_per_frame);
+    }
+  }
+  pclose(f);
+}
+
+int main(int argc, char **argv) {
+  int rows = DEFAULT_ROWS, cols = DEFAULT_COLS, frames = DEFAULT_FRAMES;
+  bool pty = false;
+  const char *term = DEFAULT_TERM;
+  const char *ncurses_benchmark = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+      rows = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--cols") == 0 && i + 1 < argc) {
+      cols = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--pty") == 0) {
+      pty = true;
+    } else if (strcmp(argv[i], "--term") == 0 && i + 1 < argc) {
+      term = argv[++i];
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      ncurses_benchmark = argv[++i];
+    } else {
+      fprintf(stderr,
+              "usage: %s [--rows <n>] [--cols <n>] [--frames <n>] [--pty] "
+              "[--term <terminfo name>] [--compare <ncurses benchmark>]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (rows < 10 || cols < 20 || frames <= 0) {
+    fprintf(stderr, "The screen needs at least 10 rows and 20 columns.\n");
+    return 1;
+  }
+
+  if (pty) {
+    pty_fd = open_pty(rows, cols);
+    if (pty_fd < 0) {
+      fprintf(stderr, "Could not open a pty.\n");
+      return 1;
+    }
+    output_to_fd(pty_fd);
+  } else {
+    output_to_sink(discard_output, NULL);
+  }
+  // the terminfo entry decides which sequences are used
+  setenv("TERM", term, 1);
+  if (!init_terminalio_headless(rows, cols)) {
+    return 1;
+  }
+
+  printf("terminalio, %s, %s, %dx%d, %d frames\n", term,
+         pty ? "pty" : "memory", cols, rows, frames);
+  struct ScenarioResult results[SCENARIO_COUNT];
+  for (int i = 0; i < SCENARIO_COUNT; i++) {
+    struct Scenario *s = get_scenario(i);
+    results[i] = run_scenario(&terminalio_backend, s, frames, rows, cols);
+    print_result(s->name, &results[i]);
+  }
+  fflush(stdout);
+
+  if (ncurses_benchmark) {
+    char command[COMMAND_SIZE];
+    snprintf(command, sizeof(command),
+             "%s --rows %d --cols %d --frames %d --term %s%s",
+             ncurses_benchmark, rows, cols, frames, term, pty ? " --pty" : "");
+    compare(command, results);
+  }
+  return 0;
+}
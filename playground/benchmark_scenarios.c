@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include "benchmark_scenarios.h"
+#include "../lib/timing.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Colors are picked from a small palette, so the number of distinct styles
+// stays bounded however long a scenario runs.
+#define PALETTE_SIZE 64
+// percentage of the cells the sparse scenario changes per frame
+#define SPARSE_CHANGES 1
+#define OVERLAY_TOGGLE_FRAMES 10
+#define HUD_WIDTH 16
+
+static const struct Rgb dark = {16, 16, 32};
+static const struct Rgb light = {224, 224, 208};
+static const struct Rgb black = {0, 0, 0};
+
+uint32_t random_state;
+
+void seed_random(uint32_t seed) { random_state = seed; }
+
+uint32_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+struct Rgb palette_color(int index) {
+  index %= PALETTE_SIZE;
+  struct Rgb c = {64 + index * 37 % 192, 64 + index * 59 % 192,
+                  64 + index * 83 % 192};
+  return c;
+}
+
+void draw_background(struct BenchmarkBackend *b, int rows, int cols) {
+  for (int y = 0; y < rows; y++) {
+    for (int x = 0; x < cols; x++) {
+      b->draw(x, y, '.', palette_color(x / 4 + y / 2), dark,
+              BENCHMARK_BACKGROUND);
+    }
+  }
+}
+
+void draw_label(struct BenchmarkBackend *b, int x, int y, const char *string,
+                 struct Rgb color, struct Rgb background,
+                 enum BenchmarkLayer layer) {
+  for (; *string; string++, x++) {
+    b->draw(x, y, *string, color, background, layer);
+  }
+}
+
+////////////////////////////////
+// Full Screen Truecolor Fill //
+////////////////////////////////
+
+void fill_setup(struct BenchmarkBackend *b, int rows, int cols) {
+  (void)b;
+  (void)rows;
+  (void)cols;
+}
+
+// Every cell changes every frame. The pattern is no shifted copy of the last
+// frame, which would be drawn by scrolling.
+void fill_frame(struct BenchmarkBackend *b, int frame, int rows, int cols) {
+  for (int y = 0; y < rows; y++) {
+    for (int x = 0; x < cols; x++) {
+      b->draw(x, y, ' ', light, palette_color((x * 3 + y) ^ frame),
+              BENCHMARK_BACKGROUND);
+    }
+  }
+}
+
+///////////////////////////
+// Sparse Random Changes //
+///////////////////////////
+
+void background_setup(struct BenchmarkBackend *b, int rows, int cols) {
+  seed_random(2463534242u);
+  draw_background(b, rows, cols);
+}
+
+void sparse_frame(struct BenchmarkBackend *b, int frame, int rows, int cols) {
+  (void)frame;
+  int changes = rows * cols * SPARSE_CHANGES / 100;
+  for (int i = 0; i < changes; i++) {
+    uint32_t r = next_random();
+    int x = r % cols;
+    int y = (r >> 16) % rows;
+    b->draw(x, y, 'a' + r % 26, palette_color(r >> 8), dark,
+            BENCHMARK_BACKGROUND);
+  }
+}
+
+/////////////////
+// HUD Updates //
+/////////////////
+
+void hud_frame(struct BenchmarkBackend *b, int frame, int rows, int cols) {
+  (void)rows;
+  char line[HUD_WIDTH + 1];
+  int x = cols - HUD_WIDTH;
+  snprintf(line, sizeof(line), "Frame: %-9d", frame);
+  draw_label(b, x, 0, line, light, dark, BENCHMARK_HUD);
+  snprintf(line, sizeof(line), "Time : %-7dms", frame * 16);
+  draw_label(b, x, 1, line, light, dark, BENCHMARK_HUD);
+  snprintf(line, sizeof(line), "Score: %-9d", frame * 7 % 1000);
+  draw_label(b, x, 2, line, light, dark, BENCHMARK_HUD);
+  snprintf(line, sizeof(line), "HP   : %-9d", 100 - frame % 100);
+  draw_label(b, x, 3, line, light, dark, BENCHMARK_HUD);
+}
+
+//////////////////////////
+// Overlay Open / Close //
+//////////////////////////
+
+void overlay_frame(struct BenchmarkBackend *b, int frame, int rows, int cols) {
+  if (frame % OVERLAY_TOGGLE_FRAMES != 0) {
+    return;
+  }
+  if (frame / OVERLAY_TOGGLE_FRAMES % 2 == 1) {
+    b->close_overlay();
+    return;
+  }
+
+  int top = rows / 4, left = cols / 4;
+  for (int y = top; y < top + rows / 2; y++) {
+    for (int x = left; x < left + cols / 2; x++) {
+      b->draw(x, y, ' ', black, light, BENCHMARK_OVERLAY);
+    }
+  }
+  draw_label(b, left + cols / 4 - 3, top + 1, "PAUSED", black, light,
+              BENCHMARK_OVERLAY);
+}
+
+///////////////////
+// Resize Storms //
+///////////////////
+
+// Shrinks and grows the screen every frame, the whole background is drawn
+// again at every size.
+void resize_frame(struct BenchmarkBackend *b, int frame, int rows, int cols) {
+  int step = frame % 4;
+  rows -= step * 2;
+  cols -= step * 5;
+  b->resize(rows, cols);
+  draw_background(b, rows, cols);
+}
+
+struct Scenario scenarios[SCENARIO_COUNT] = {
+    {"fill", fill_setup, fill_frame},
+    {"sparse", background_setup, sparse_frame},
+    {"hud", background_setup, hud_frame},
+    {"overlay", background_setup, overlay_frame},
+    {"resize", background_setup, resize_frame},
+};
+
+struct Scenario *get_scenario(int index) { return &scenarios[index]; }
+
+////////////
+// Runner //
+////////////
+
+struct ScenarioResult run_scenario(struct BenchmarkBackend *b,
+                                   struct Scenario *s, int frames, int rows,
+                                   int cols) {
+  b->resize(rows, cols);
+  b->clear();
+  s->setup(b, rows, cols);
+  b->present();
+
+  uint64_t bytes, writes, bytes_after, writes_after;
+  b->output_stats(&bytes, &writes);
+  int64_t start = now();
+  for (int frame = 0; frame < frames; frame++) {
+    s->frame(b, frame, rows, cols);
+    b->present();
+  }
+  int64_t duration = now() - start;
+  b->output_stats(&bytes_after, &writes_after);
+
+  struct ScenarioResult r = {
+      duration / frames,
+      (double)(bytes_after - bytes) / frames,
+      (double)(writes_after - writes) / frames,
+  };
+  return r;
+}
+
+void print_result(const char *scenario, struct ScenarioResult *r) {
+  printf("%-8s %10ld ns/frame %10.1f bytes/frame %6.2f writes/frame\n",
+         scenario, (long)r->nanoseconds_per_frame, r->bytes_per_frame,
+         r->writes_per_frame);
+}
+
+bool parse_result(const char *line, char *scenario, unsigned int size,
+                  struct ScenarioResult *r) {
+  char name[32];
+  long nanoseconds;
+  if (sscanf(line, "%31s %ld ns/frame %lf bytes/frame %lf writes/frame", name,
+             &nanoseconds, &r->bytes_per_frame, &r->writes_per_frame) != 4) {
+    return false;
+  }
+  r->nanoseconds_per_frame = nanoseconds;
+  snprintf(scenario, size, "%s", name);
+  return true;
+}
+
+////////////////////
+// Pipes and Ptys //
+////////////////////
+
+int drained_fd = -1;
+pthread_t drain_thread;
+
+// Reads and discards what the renderer writes, like a terminal that always
+// keeps up.
+void *drain(void *argument) {
+  (void)argument;
+  char buffer[1 << 16];
+  while (read(drained_fd, buffer, sizeof(buffer)) > 0) {
+  }
+  return NULL;
+}
+
+int open_pipe(void) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  drained_fd = fds[0];
+  if (pthread_create(&drain_thread, NULL, drain, NULL) != 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  return fds[1];
+}
+
+void resize_pty(int fd, int rows, int cols) {
+  struct winsize size = {rows, cols, 0, 0};
+  ioctl(fd, TIOCSWINSZ, &size);
+}
+
+int open_pty(int rows, int cols) {
+  drained_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (drained_fd < 0 || grantpt(drained_fd) != 0 ||
+      unlockpt(drained_fd) != 0) {
+    return -1;
+  }
+  int slave = open(ptsname(drained_fd), O_RDWR | O_NOCTTY);
+  if (slave < 0) {
+    return -1;
+  }
+
+  struct termios raw;
+  tcgetattr(slave, &raw);
+  cfmakeraw(&raw);
+  tcsetattr(slave, TCSANOW, &raw);
+  resize_pty(slave, rows, cols);
+
+  if (pthread_create(&drain_thread, NULL, drain, NULL) != 0) {
+    close(slave);
+    return -1;
+  }
+  return slave;
+}
+
+// The kernel's count of bytes written and write calls made by the process.
+void process_write_stats(uint64_t *bytes, uint64_t *writes) {
+  *bytes = *writes = 0;
+  FILE *f = fopen("/proc/self/io", "r");
+  if (!f) {
+    return;
+  }
+  char name[32];
+  unsigned long long value;
+  while (fscanf(f, "%31[^:]: %llu\n", name, &value) == 2) {
+    if (strcmp(name, "wchar") == 0) {
+      *bytes = value;
+    } else if (strcmp(name, "syscw") == 0) {
+      *writes = value;
+    }
+  }
+  fclose(f);
+}
@@ -0,0 +1,75 @@
+#ifndef benchmark_scenarios_h
+#define benchmark_scenarios_h
+#include <stdbool.h>
+#include <stdint.h>
+
+// Scripted drawing scenarios shared by the terminalio and the ncurses
+// benchmark, so both renderers get the same work frame by frame.
+
+struct Rgb {
+  uint8_t red, green, blue;
+};
+
+// Background and HUD keep what was drawn into them, the overlay covers both
+// until it is closed.
+enum BenchmarkLayer {
+  BENCHMARK_BACKGROUND,
+  BENCHMARK_HUD,
+  BENCHMARK_OVERLAY,
+};
+
+// What the scenarios draw with, implemented once per renderer.
+struct BenchmarkBackend {
+  const char *name;
+  // empties every layer
+  void (*clear)(void);
+  void (*draw)(int x, int y, char character, struct Rgb color,
+               struct Rgb background, enum BenchmarkLayer layer);
+  void (*close_overlay)(void);
+  // puts the frame on the screen
+  void (*present)(void);
+  // resizes the screen, everything has to be drawn again afterwards
+  void (*resize)(int rows, int cols);
+  // bytes and write calls so far
+  void (*output_stats)(uint64_t *bytes, uint64_t *writes);
+};
+
+struct Scenario {
+  const char *name;
+  void (*setup)(struct BenchmarkBackend *b, int rows, int cols);
+  void (*frame)(struct BenchmarkBackend *b, int frame, int rows, int cols);
+};
+
+struct ScenarioResult {
+  int64_t nanoseconds_per_frame;
+  double bytes_per_frame;
+  double writes_per_frame;
+};
+
+#define SCENARIO_COUNT 5
+struct Scenario *get_scenario(int index);
+
+// The xorshift generator the scenarios draw with, seeded in their setup so
+// every run changes the same cells.
+void seed_random(uint32_t seed);
+uint32_t next_random(void);
+
+// Presents frames frames of the scenario after its setup, only the frames are
+// measured.
+struct ScenarioResult run_scenario(struct BenchmarkBackend *b,
+                                   struct Scenario *s, int frames, int rows,
+                                   int cols);
+// Prints one line per scenario in a format read back by --compare.
+void print_result(const char *scenario, struct ScenarioResult *r);
+bool parse_result(const char *line, char *scenario, unsigned int size,
+                  struct ScenarioResult *r);
+
+// Open a pipe, or a pty of the given size, whose output is read and
+// discarded by a thread, and return the fd to render into, -1 on failure.
+int open_pipe(void);
+int open_pty(int rows, int cols);
+void resize_pty(int fd, int rows, int cols);
+// bytes written and write calls made by the process, see /proc/self/io
+void process_write_stats(uint64_t *bytes, uint64_t *writes);
+
+#endif
@@ -0,0 +1,174 @@
+#include "benchmark_scenarios.h"
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The benchmark scenarios on ncurses, for comparison with benchmark.c which
+// runs them on terminalio. ncurses writes into a pipe, or a pty with --pty,
+// that is read as fast as possible. ncurses writes to the file descriptor
+// behind its stream directly, so bytes and writes are counted by the kernel.
+// Colors are mapped to the 256 color palette, ncurses needs a direct color
+// terminfo entry for truecolor.
+//
+// gcc -O2 playground/ncurses_benchmark.c playground/benchmark_scenarios.c
+//     lib/timing.c -lncursesw -pthread -o ncurses_benchmark
+
+#define DEFAULT_ROWS 50
+#define DEFAULT_COLS 200
+#define DEFAULT_FRAMES 600
+#define DEFAULT_TERM "xterm-256color"
+
+int pty_fd = -1;
+
+// What background and HUD show under the overlay, ncurses has no layers so
+// it is drawn again when the overlay is closed.
+struct ShadowCell {
+  char character;
+  short pair;
+  bool covered;
+};
+
+struct ShadowCell *shadow;
+int shadow_rows, shadow_cols;
+
+short color_index(struct Rgb c) {
+  // the 6x6x6 color cube of the 256 color palette
+  return 16 + 36 * ((c.red * 5 + 127) / 255) +
+         6 * ((c.green * 5 + 127) / 255) + (c.blue * 5 + 127) / 255;
+}
+
+void clear_screen(void) {
+  erase();
+  memset(shadow, 0, sizeof(*shadow) * shadow_rows * shadow_cols);
+}
+
+void put(int x, int y, char character, short pair) {
+  attr_set(A_NORMAL, pair, NULL);
+  mvaddch(y, x, character);
+}
+
+void draw(int x, int y, char character, struct Rgb color,
+          struct Rgb background, enum BenchmarkLayer layer) {
+  if (x < 0 || y < 0 || x >= shadow_cols || y >= shadow_rows) {
+    return;
+  }
+  short pair = alloc_pair(color_index(color), color_index(background));
+  struct ShadowCell *cell = &shadow[y * shadow_cols + x];
+  if (layer == BENCHMARK_OVERLAY) {
+    cell->covered = true;
+    put(x, y, character, pair);
+    return;
+  }
+
+  cell->character = character;
+  cell->pair = pair;
+  if (!cell->covered) {
+    put(x, y, character, pair);
+  }
+}
+
+void close_overlay(void) {
+  for (int y = 0; y < shadow_rows; y++) {
+    for (int x = 0; x < shadow_cols; x++) {
+      struct ShadowCell *cell = &shadow[y * shadow_cols + x];
+      if (cell->covered) {
+        cell->covered = false;
+        put(x, y, cell->character ? cell->character : ' ', cell->pair);
+      }
+    }
+  }
+}
+
+void present(void) { refresh(); }
+
+void resize(int rows, int cols) {
+  if (rows == shadow_rows && cols == shadow_cols) {
+    return;
+  }
+  if (pty_fd >= 0) {
+    resize_pty(pty_fd, rows, cols);
+  }
+  resizeterm(rows, cols);
+  free(shadow);
+  shadow = calloc((size_t)rows * cols, sizeof(*shadow));
+  shadow_rows = rows;
+  shadow_cols = cols;
+}
+
+struct BenchmarkBackend ncurses_backend = {
+    "ncurses", clear_screen, draw,   close_overlay,
+    present,   resize,       process_write_stats,
+};
+
+int main(int argc, char **argv) {
+  int rows = DEFAULT_ROWS, cols = DEFAULT_COLS, frames = DEFAULT_FRAMES;
+  bool pty = false;
+  const char *term = DEFAULT_TERM;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+      rows = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--cols") == 0 && i + 1 < argc) {
+      cols = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--pty") == 0) {
+      pty = true;
+    } else if (strcmp(argv[i], "--term") == 0 && i + 1 < argc) {
+      term = argv[++i];
+    } else {
+      fprintf(stderr,
+              "usage: %s [--rows <n>] [--cols <n>] [--frames <n>] [--pty] "
+              "[--term <terminfo name>]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (rows < 10 || cols < 20 || frames <= 0) {
+    fprintf(stderr, "The screen needs at least 10 rows and 20 columns.\n");
+    return 1;
+  }
+
+  int fd = pty ? open_pty(rows, cols) : open_pipe();
+  if (fd < 0) {
+    fprintf(stderr, "Could not open a %s.\n", pty ? "pty" : "pipe");
+    return 1;
+  }
+  if (pty) {
+    pty_fd = fd;
+  }
+
+  // a pipe has no size to ask for
+  char size[16];
+  snprintf(size, sizeof(size), "%d", rows);
+  setenv("LINES", size, 1);
+  snprintf(size, sizeof(size), "%d", cols);
+  setenv("COLUMNS", size, 1);
+
+  FILE *out = fdopen(fd, "w");
+  FILE *in = fopen("/dev/null", "r");
+  if (!out || !in || !newterm(term, out, in)) {
+    fprintf(stderr, "Could not start ncurses.\n");
+    return 1;
+  }
+  start_color();
+  curs_set(0);
+  shadow = calloc((size_t)rows * cols, sizeof(*shadow));
+  shadow_rows = rows;
+  shadow_cols = cols;
+
+  struct ScenarioResult results[SCENARIO_COUNT];
+  for (int i = 0; i < SCENARIO_COUNT; i++) {
+    results[i] = run_scenario(&ncurses_backend, get_scenario(i), frames, rows,
+                              cols);
+  }
+  endwin();
+
+  printf("ncurses, %s, %s, %dx%d, %d frames\n", term, pty ? "pty" : "pipe",
+         cols, rows, frames);
+  for (int i = 0; i < SCENARIO_COUNT; i++) {
+    print_result(get_scenario(i)->name, &results[i]);
+  }
+  return 0;
+}
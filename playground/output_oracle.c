@@ -0,0 +1,552 @@
+#include "../lib/output.h"
+#include "../lib/terminalio.h"
+#include "benchmark_scenarios.h"
+#include "vt_screen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Checks that terminalio's output is correct and stays small. Every frame of
+// the benchmark scenarios, and of two that use more of the renderer, is fed
+// into a terminal emulator, whose screen then has to show exactly what the
+// composited frame holds. The bytes each scenario took are compared with the
+// golden counts in output_golden.txt, more bytes than recorded fail the run.
+// --update records the current counts, e.g. after an optimization. Then
+// the style table is filled beyond its capacity, which has to be reported,
+// and last the render thread has to diff only what changed.
+//
+// gcc -O2 playground/output_oracle.c playground/vt_screen.c
+//     playground/benchmark_scenarios.c lib/*.c -lunibilium -pthread
+//     -o output_oracle
+
+#define DEFAULT_ROWS 40
+#define DEFAULT_COLS 120
+#define DEFAULT_FRAMES 200
+#define DEFAULT_TERM "xterm-256color"
+#define DEFAULT_GOLDEN "playground/output_golden.txt"
+#define ORACLE_SCENARIO_COUNT (SCENARIO_COUNT + 2)
+#define MAX_GOLDEN 128
+#define GOLDEN_KEY_SIZE 128
+#define STYLE_TEXT_SIZE 96
+
+struct VtScreen screen;
+// bytes the emulator was fed since the scenario started
+uint64_t scenario_bytes;
+unsigned int presented_frames;
+// the first mismatch of the scenario, empty if there is none
+char mismatch[2 * STYLE_TEXT_SIZE + 128];
+
+const enum Layer oracle_layers[] = {
+    [BENCHMARK_BACKGROUND] = LAYER_LEVEL,
+    [BENCHMARK_HUD] = LAYER_HUD,
+    [BENCHMARK_OVERLAY] = LAYER_OVERLAY,
+};
+
+void emulate_output(const char *bytes, size_t length, void *context) {
+  (void)context;
+  feed_vt_screen(&screen, bytes, length);
+  scenario_bytes += length;
+}
+
+////////////////////////
+// Screen Comparisons //
+////////////////////////
+
+bool colors_equal(struct Color a, struct Color b) {
+  if (a.type != b.type) {
+    return false;
+  }
+  switch (a.type) {
+  case DEFAULT:
+    return true;
+  case _8:
+  case _256:
+    return a.color == b.color;
+  case TRUE:
+    return a.red == b.red && a.green == b.green && a.blue == b.blue;
+  }
+  return false;
+}
+
+bool styles_equal(struct Style a, struct Style b) {
+  return colors_equal(a.color, b.color) &&
+         colors_equal(a.background, b.background) && a.modes == b.modes;
+}
+
+int describe_color(char *out, size_t size, struct Color c) {
+  switch (c.type) {
+  case DEFAULT:
+    return snprintf(out, size, "default");
+  case _8:
+    return snprintf(out, size, "8:%u", c.color);
+  case _256:
+    return snprintf(out, size, "256:%u", c.color);
+  case TRUE:
+    return snprintf(out, size, "rgb(%u,%u,%u)", c.red, c.green, c.blue);
+  }
+  return snprintf(out, size, "?");
+}
+
+void describe_cell(char *out, size_t size, uint32_t codepoint,
+                   struct Style style) {
+  int length = snprintf(out, size, "U+%04X ", codepoint);
+  length += describe_color(out + length, size - length, style.color);
+  length += snprintf(out + length, size - length, " on ");
+  length += describe_color(out + length, size - length, style.background);
+  snprintf(out + length, size - length, " modes 0x%x", style.modes);
+}
+
+// Compares the emulated screen with the composited frame, only the first
+// mismatch of a scenario is kept.
+void check_screen(void) {
+  if (mismatch[0]) {
+    return;
+  }
+  if (screen.error[0]) {
+    snprintf(mismatch, sizeof(mismatch), "frame %u: %s", presented_frames,
+             screen.error);
+    return;
+  }
+
+  for (unsigned int y = 0; y < screen.rows; y++) {
+    for (unsigned int x = 0; x < screen.cols; x++) {
+      struct Cell expected = frame_cell(x, y);
+      struct Style expected_style = cell_style(expected.style);
+      struct VtCell *shown = vt_screen_cell(&screen, x, y);
+      if (shown->codepoint == expected.codepoint &&
+          styles_equal(shown->style, expected_style)) {
+        continue;
+      }
+
+      char want[STYLE_TEXT_SIZE], got[STYLE_TEXT_SIZE];
+      describe_cell(want, sizeof(want), expected.codepoint, expected_style);
+      describe_cell(got, sizeof(got), shown->codepoint, shown->style);
+      snprintf(mismatch, sizeof(mismatch),
+               "frame %u, cell (%u, %u): expected %s, shown %s",
+               presented_frames, x, y, want, got);
+      return;
+    }
+  }
+}
+
+/////////////
+// Backend //
+/////////////
+
+void clear_layers(void) {
+  clear_layer(LAYER_LEVEL);
+  clear_layer(LAYER_HUD);
+  clear_layer(LAYER_OVERLAY);
+}
+
+void draw(int x, int y, char character, struct Rgb color,
+          struct Rgb background, enum BenchmarkLayer layer) {
+  select_layer(oracle_layers[layer]);
+  struct Display d = {{character, '\0'},
+                      color_style(color_rgb(color.red, color.green, color.blue),
+                                  color_rgb(background.red, background.green,
+                                            background.blue))};
+  draw_display(x, y, d);
+}
+
+void close_overlay(void) { clear_layer(LAYER_OVERLAY); }
+
+void present(void) {
+  render_frame();
+  check_screen();
+  presented_frames++;
+}
+
+// The emulated terminal gets the new size first, like a real one does before
+// the program notices.
+void resize(int rows, int cols) {
+  if ((unsigned int)rows != screen.rows || (unsigned int)cols != screen.cols) {
+    resize_vt_screen(&screen, rows, cols);
+  }
+  resize_headless(rows, cols);
+}
+
+struct BenchmarkBackend oracle_backend = {
+    "terminalio", clear_layers, draw, close_overlay, present, resize,
+    output_stats,
+};
+
+/////////////////////////////
+// Renderer Only Scenarios //
+/////////////////////////////
+
+// These draw with terminalio directly, to get colors, modes, wide UTF-8
+// encodings and blank runs the benchmark scenarios do not use.
+
+#define STYLE_CHOICES 48
+#define CHARACTER_CHOICES 6
+#define SCROLL_PERIOD 24
+// a space in the default style, see draw_choice
+#define BLANK_CHOICE 4
+
+struct Style style_choices[STYLE_CHOICES];
+const char *character_choices[CHARACTER_CHOICES] = {
+    "a", "é", "→", "█", " ", "\xf0\x9f\x90\x89",
+};
+
+struct Color random_color(void) {
+  uint32_t r = next_random();
+  switch (r % 4) {
+  case 0:
+    return default_color();
+  case 1:
+    return color_8(r >> 8 & 7);
+  case 2:
+    return color_256(r >> 8);
+  default:
+    return color_rgb(r >> 8, r >> 16, r >> 24);
+  }
+}
+
+void styles_setup(struct BenchmarkBackend *b, int rows, int cols) {
+  (void)b;
+  (void)rows;
+  (void)cols;
+  seed_random(88172645u);
+  // the first choice is the default style, drawing it with a space erases
+  style_choices[0] = default_style();
+  for (int i = 1; i < STYLE_CHOICES; i++) {
+    style_choices[i] = color_style(random_color(), random_color());
+    style_choices[i].modes = next_random() & MODES_MASK;
+  }
+}
+
+void draw_choice(int x, int y, uint32_t r) {
+  struct Display d;
+  strcpy(d.character, character_choices[r % CHARACTER_CHOICES]);
+  d.style = style_choices[(r >> 8) % STYLE_CHOICES];
+  draw_display(x, y, d);
+}
+
+// Random cells and blank runs in many styles, the level is cleared now and
+// then.
+void styles_frame(struct BenchmarkBackend *b, int frame, int rows,
+                  int cols) {
+  (void)b;
+  select_layer(LAYER_LEVEL);
+  if (frame % 50 == 49) {
+    clear_layer(LAYER_LEVEL);
+  }
+
+  for (int i = 0; i < rows * cols / 50; i++) {
+    uint32_t r = next_random();
+    draw_choice(r % cols, (r >> 16) % rows, next_random());
+  }
+
+  // a run of one cell, blank half of the time
+  uint32_t r = next_random();
+  int y = r % rows, x = (r >> 8) % cols, length = (r >> 16) % cols;
+  uint32_t choice = r >> 24 & 1 ? next_random() : BLANK_CHOICE;
+  for (int i = x; i < x + length && i < cols; i++) {
+    draw_choice(i, y, choice);
+  }
+
+  select_layer(LAYER_ENTITIES);
+  draw_choice(frame % cols, frame % rows, next_random());
+}
+
+void scrolling_setup(struct BenchmarkBackend *b, int rows, int cols) {
+  styles_setup(b, rows, cols);
+}
+
+// Rows of different lengths scroll up and back down under a fixed HUD row,
+// with an entity moving across them.
+void scrolling_frame(struct BenchmarkBackend *b, int frame, int rows,
+                     int cols) {
+  (void)b;
+  int phase = frame % (2 * SCROLL_PERIOD);
+  int offset = phase < SCROLL_PERIOD ? phase : 2 * SCROLL_PERIOD - phase;
+
+  select_layer(LAYER_LEVEL);
+  clear_layer(LAYER_LEVEL);
+  for (int y = 1; y < rows; y++) {
+    int line = y + offset;
+    int length = line * 37 % cols;
+    struct Display d = {"", style_choices[1 + line % (STYLE_CHOICES - 1)]};
+    for (int x = 0; x < length; x++) {
+      d.character[0] = 'a' + (line * 7 + x) % 26;
+      draw_display(x, y, d);
+    }
+  }
+
+  select_layer(LAYER_HUD);
+  draw_sstring(0, 0, style_choices[1], "frame %d", frame);
+  select_layer(LAYER_ENTITIES);
+  draw_sstring(frame % cols, rows / 2, style_choices[2], "@");
+}
+
+struct Scenario oracle_scenarios[] = {
+    {"styles", styles_setup, styles_frame},
+    {"scroll", scrolling_setup, scrolling_frame},
+};
+
+struct Scenario *get_oracle_scenario(int index) {
+  return index < SCENARIO_COUNT ? get_scenario(index)
+                                : &oracle_scenarios[index - SCENARIO_COUNT];
+}
+
+/////////////////
+// Style Table //
+/////////////////
+
+// more distinct styles than the style table holds
+#define OVERFLOW_STYLES 8192
+
+// Draws more styles than fit into the style table. Those beyond it are drawn
+// in the default style, the screen still has to match the frame and the
+// overflow has to be counted. Runs after the scenarios, the table stays
+// full.
+bool check_style_overflow(int rows, int cols) {
+  mismatch[0] = '\0';
+  clear_layers();
+  select_layer(LAYER_LEVEL);
+  unsigned int before = style_overflows();
+  for (int i = 0; i < OVERFLOW_STYLES; i++) {
+    struct Style style = color_style(color_rgb(i, i >> 8, 1), default_color());
+    draw_display(i % cols, i / cols % rows, (struct Display){"x", style});
+  }
+  present();
+
+  unsigned int overflows = style_overflows() - before;
+  printf("%-8s %10u overflows  ", "overflow", overflows);
+  if (mismatch[0]) {
+    printf("SCREEN MISMATCH, %s\n", mismatch);
+    return false;
+  }
+  if (overflows == 0) {
+    printf("NOT REPORTED\n");
+    return false;
+  }
+  printf("reported\n");
+  return true;
+}
+
+///////////////////
+// Render Thread //
+///////////////////
+
+// more frames than the render thread averages its profile over, so the
+// first one, which draws everything, is out of the average
+#define DAMAGE_FRAMES 720
+// long enough for the render thread to present each frame, none is dropped
+#define DAMAGE_FRAME_PAUSE_MICROSECONDS 2000
+
+// One character moves over a full background, a frame that covers no dropped
+// frame has to be diffed only where the character was and is, not in every
+// drawn row. Starts the render thread, so it runs last.
+bool check_render_thread_damage(int rows, int cols) {
+  mismatch[0] = '\0';
+  clear_layers();
+  printf("%-8s ", "damage");
+  if (!start_render_thread()) {
+    printf("RENDER THREAD NOT STARTED\n");
+    return false;
+  }
+
+  // covers what the screen still shows, the new frame buffers do not know it
+  select_layer(LAYER_LEVEL);
+  for (int y = 0; y < rows; y++) {
+    for (int x = 0; x < cols; x++) {
+      draw_display(x, y, (struct Display){".", default_style()});
+    }
+  }
+  select_layer(LAYER_ENTITIES);
+  for (int i = 0; i < DAMAGE_FRAMES; i++) {
+    draw_display(i % cols, i / cols % rows,
+                 (struct Display){"x", default_style()});
+    render_frame();
+    usleep(DAMAGE_FRAME_PAUSE_MICROSECONDS);
+  }
+  usleep(100 * DAMAGE_FRAME_PAUSE_MICROSECONDS);
+  check_screen();
+
+  struct FrameInfo average;
+  unsigned int dropped, coalesced;
+  bool averaged = render_thread_profile(&average);
+  frame_drop_stats(&dropped, &coalesced);
+  printf("%10u cells diffed per frame, %u dropped  ",
+         average.counters.cells_diffed, dropped);
+  if (mismatch[0]) {
+    printf("SCREEN MISMATCH, %s\n", mismatch);
+    return false;
+  }
+  // two cells a frame, dropped frames diff everything drawn
+  if (!averaged || average.counters.cells_diffed >= (unsigned int)cols) {
+    printf("NOT ONLY THE DAMAGE\n");
+    return false;
+  }
+  printf("only the damage\n");
+  return true;
+}
+
+//////////////////
+// Golden Bytes //
+//////////////////
+
+// Byte counts depend on the terminfo entry, the screen size and the number
+// of frames, they are part of the key.
+struct Golden {
+  char key[GOLDEN_KEY_SIZE];
+  unsigned long long bytes;
+};
+
+struct Golden golden[MAX_GOLDEN];
+int golden_count;
+
+void golden_key(char *key, const char *scenario, const char *term, int rows,
+                int cols, int frames) {
+  snprintf(key, GOLDEN_KEY_SIZE, "%s %s %dx%d %d", scenario, term, cols, rows,
+           frames);
+}
+
+struct Golden *find_golden(const char *key) {
+  for (int i = 0; i < golden_count; i++) {
+    if (strcmp(golden[i].key, key) == 0) {
+      return &golden[i];
+    }
+  }
+  return NULL;
+}
+
+void load_golden(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return;
+  }
+  char line[256], scenario[32], term[64], size[16], frames[16];
+  unsigned long long bytes;
+  while (fgets(line, sizeof(line), f) && golden_count < MAX_GOLDEN) {
+    if (line[0] == '#' ||
+        sscanf(line, "%31s %63s %15s %15s %llu", scenario, term, size, frames,
+               &bytes) != 5) {
+      continue;
+    }
+    struct Golden *g = &golden[golden_count++];
+    snprintf(g->key, sizeof(g->key), "%s %s %s %s", scenario, term, size,
+             frames);
+    g->bytes = bytes;
+  }
+  fclose(f);
+}
+
+bool save_golden(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    return false;
+  }
+  fprintf(f, "# bytes terminalio writes per scenario, see output_oracle.c\n"
+             "# scenario term colsxrows frames bytes\n");
+  for (int i = 0; i < golden_count; i++) {
+    fprintf(f, "%s %llu\n", golden[i].key, golden[i].bytes);
+  }
+  fclose(f);
+  return true;
+}
+
+// Prints how the scenario compares to its golden count, false on growth.
+bool compare_golden(const char *key, uint64_t bytes, bool update) {
+  struct Golden *g = find_golden(key);
+  if (update) {
+    if (!g && golden_count < MAX_GOLDEN) {
+      g = &golden[golden_count++];
+      snprintf(g->key, sizeof(g->key), "%s", key);
+    }
+    if (g) {
+      g->bytes = bytes;
+    }
+    printf("recorded\n");
+    return true;
+  }
+
+  if (!g) {
+    printf("no golden count, run with --update\n");
+  } else if (bytes > g->bytes) {
+    printf("REGRESSION, %llu bytes more than %llu\n",
+           (unsigned long long)bytes - g->bytes, g->bytes);
+    return false;
+  } else if (bytes < g->bytes) {
+    printf("%llu bytes less than %llu, run with --update\n",
+           g->bytes - (unsigned long long)bytes, g->bytes);
+  } else {
+    printf("as recorded\n");
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int rows = DEFAULT_ROWS, cols = DEFAULT_COLS, frames = DEFAULT_FRAMES;
+  const char *term = DEFAULT_TERM;
+  const char *golden_path = DEFAULT_GOLDEN;
+  bool update = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+      rows = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--cols") == 0 && i + 1 < argc) {
+      cols = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--term") == 0 && i + 1 < argc) {
+      term = argv[++i];
+    } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+      golden_path = argv[++i];
+    } else if (strcmp(argv[i], "--update") == 0) {
+      update = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--rows <n>] [--cols <n>] [--frames <n>] "
+              "[--term <terminfo name>] [--golden <file>] [--update]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (rows < 10 || cols < 20 || frames <= 0) {
+    fprintf(stderr, "The screen needs at least 10 rows and 20 columns.\n");
+    return 1;
+  }
+
+  if (!init_vt_screen(&screen, rows, cols)) {
+    return 1;
+  }
+  output_to_sink(emulate_output, NULL);
+  setenv("TERM", term, 1);
+  if (!init_terminalio_headless(rows, cols)) {
+    return 1;
+  }
+  load_golden(golden_path);
+
+  printf("terminalio, %s, %dx%d, %d frames\n", term, cols, rows, frames);
+  bool passed = true;
+  for (int i = 0; i < ORACLE_SCENARIO_COUNT; i++) {
+    struct Scenario *s = get_oracle_scenario(i);
+    scenario_bytes = 0;
+    presented_frames = 0;
+    mismatch[0] = '\0';
+    run_scenario(&oracle_backend, s, frames, rows, cols);
+
+    printf("%-8s %10llu bytes  ", s->name,
+           (unsigned long long)scenario_bytes);
+    if (mismatch[0]) {
+      printf("SCREEN MISMATCH, %s\n", mismatch);
+      passed = false;
+      continue;
+    }
+    char key[GOLDEN_KEY_SIZE];
+    golden_key(key, s->name, term, rows, cols, frames);
+    passed &= compare_golden(key, scenario_bytes, update);
+  }
+  passed &= check_style_overflow(rows, cols);
+  passed &= check_render_thread_damage(rows, cols);
+
+  if (update && !save_golden(golden_path)) {
+    fprintf(stderr, "Could not write %s\n", golden_path);
+    return 1;
+  }
+  free_vt_screen(&screen);
+  return passed ? 0 : 1;
+}
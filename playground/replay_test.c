@@ -0,0 +1,129 @@
+#include "../lib/session.h"
+#include "vt_screen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks that a replay runs the ticks in the batches they were recorded in.
+// A lone ESC is only resolved between batches, so after a burst of ticks the
+// rest of an arrow key that arrived late still completes it, while one tick
+// at a time the ESC times out first. Session logs of both are written and
+// replayed by the game, whose player has to end up one cell apart, and a
+// replay has to write the same bytes every time.
+//
+// gcc -O2 playground/replay_test.c playground/vt_screen.c lib/*.c
+//     -lunibilium -pthread -o replay_test
+// ./replay_test <game binary>
+
+#define ROWS 24
+#define COLS 80
+#define TERM "xterm-256color"
+#define ESCAPE_TICK 10
+// more ticks than the ESC timeout takes, run at once like after a stall
+#define BURST_TICKS 12
+#define OUTPUT_SIZE (1 << 20)
+#define COMMAND_SIZE 512
+#define PLAYER 0x25A0
+
+char output[OUTPUT_SIZE];
+
+// ESC at ESCAPE_TICK and the rest of a right arrow BURST_TICKS later, with
+// the ticks in between in one batch or one by one.
+bool write_session(const char *path, bool burst) {
+  struct SessionHeader header = {TERM, ROWS, COLS};
+  if (!start_recording(path, &header)) {
+    return false;
+  }
+  record_input(ESCAPE_TICK, "\033", 1);
+  if (burst) {
+    record_ticks(ESCAPE_TICK, BURST_TICKS);
+  }
+  record_input(ESCAPE_TICK + BURST_TICKS, "[C", 2);
+  // the replay ends with the log, the move needs a tick more
+  record_resize(ESCAPE_TICK + 2 * BURST_TICKS, ROWS, COLS);
+  stop_recording();
+  return true;
+}
+
+// Replays the log and returns how many bytes the game wrote, 0 on failure.
+size_t replay(const char *game, const char *path) {
+  char command[COMMAND_SIZE];
+  snprintf(command, sizeof(command), "%s --replay %s --fast", game, path);
+  FILE *f = popen(command, "r");
+  if (!f) {
+    return 0;
+  }
+  size_t length = fread(output, 1, sizeof(output), f);
+  return pclose(f) == 0 ? length : 0;
+}
+
+// Where the replay left the player, false when it is not on the screen.
+bool player_position(size_t length, unsigned int *x, unsigned int *y) {
+  struct VtScreen screen;
+  if (!init_vt_screen(&screen, ROWS, COLS)) {
+    return false;
+  }
+  feed_vt_screen(&screen, output, length);
+  bool found = false;
+  for (unsigned int row = 0; row < ROWS && !found; row++) {
+    for (unsigned int col = 0; col < COLS && !found; col++) {
+      if (vt_screen_cell(&screen, col, row)->codepoint == PLAYER) {
+        *x = col;
+        *y = row;
+        found = true;
+      }
+    }
+  }
+  free_vt_screen(&screen);
+  return found;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <game binary>\n", argv[0]);
+    return 1;
+  }
+  const char *paths[2] = {"replay_test_ticks.vsr", "replay_test_burst.vsr"};
+  unsigned int x[2], y[2];
+  size_t lengths[2];
+  for (int burst = 0; burst < 2; burst++) {
+    if (!write_session(paths[burst], burst)) {
+      fprintf(stderr, "Could not write %s\n", paths[burst]);
+      return 1;
+    }
+    lengths[burst] = replay(argv[1], paths[burst]);
+    if (lengths[burst] == 0 ||
+        !player_position(lengths[burst], &x[burst], &y[burst])) {
+      fprintf(stderr, "Could not replay %s\n", paths[burst]);
+      return 1;
+    }
+    printf("%-6s player at %u, %u\n", burst ? "burst" : "ticks", x[burst],
+           y[burst]);
+  }
+
+  // the burst replay is still in output
+  char *first = malloc(lengths[1]);
+  if (!first) {
+    return 1;
+  }
+  memcpy(first, output, lengths[1]);
+  bool same = replay(argv[1], paths[1]) == lengths[1] &&
+              memcmp(first, output, lengths[1]) == 0;
+  free(first);
+  remove(paths[0]);
+  remove(paths[1]);
+
+  bool passed = true;
+  if (x[1] != x[0] + 1 || y[1] != y[0]) {
+    printf("BATCHES NOT REPLAYED, the arrow key has to move the player\n");
+    passed = false;
+  }
+  if (!same) {
+    printf("REPLAYS DIFFER\n");
+    passed = false;
+  }
+  if (passed) {
+    printf("passed\n");
+  }
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,498 @@
+#include "vt_screen.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void vt_error(struct VtScreen *s, const char *format, ...) {
+  if (s->error[0]) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vsnprintf(s->error, sizeof(s->error), format, args);
+  va_end(args);
+}
+
+// the SGR codes of enum OutputMode, 6 is unused
+bool vt_mode(unsigned int code) {
+  return code >= BOLD && code <= STRIKETHROUGH && code != 6;
+}
+
+unsigned int clamp(unsigned int value, unsigned int low, unsigned int high) {
+  return value < low ? low : value > high ? high : value;
+}
+
+////////////////////
+// Grid and Cells //
+////////////////////
+
+// Erased cells keep the current background, like xterm's back color erase.
+struct VtCell vt_blank(struct VtScreen *s) {
+  struct VtCell c = {' ', default_style()};
+  c.style.background = s->style.background;
+  return c;
+}
+
+struct VtCell *vt_screen_cell(struct VtScreen *s, unsigned int x,
+                              unsigned int y) {
+  return &s->cells[y * s->cols + x];
+}
+
+// Erases [start, end) of row y.
+void vt_erase(struct VtScreen *s, unsigned int y, unsigned int start,
+              unsigned int end) {
+  struct VtCell blank = vt_blank(s);
+  for (unsigned int x = start; x < end && x < s->cols; x++) {
+    *vt_screen_cell(s, x, y) = blank;
+  }
+}
+
+// Moves rows [top, bottom] by offset rows, positive is down, and erases the
+// rows that come in.
+void vt_scroll(struct VtScreen *s, unsigned int top, unsigned int bottom,
+               int offset) {
+  unsigned int height = bottom - top + 1;
+  unsigned int distance = abs(offset);
+  if (distance > height) {
+    distance = height;
+  }
+  size_t row_size = s->cols * sizeof(struct VtCell);
+  if (offset > 0) {
+    memmove(vt_screen_cell(s, 0, top + distance), vt_screen_cell(s, 0, top),
+            (height - distance) * row_size);
+    for (unsigned int y = top; y < top + distance; y++) {
+      vt_erase(s, y, 0, s->cols);
+    }
+  } else {
+    memmove(vt_screen_cell(s, 0, top), vt_screen_cell(s, 0, top + distance),
+            (height - distance) * row_size);
+    for (unsigned int y = bottom + 1 - distance; y <= bottom; y++) {
+      vt_erase(s, y, 0, s->cols);
+    }
+  }
+}
+
+bool init_vt_screen(struct VtScreen *s, unsigned int rows, unsigned int cols) {
+  memset(s, 0, sizeof(*s));
+  s->style = default_style();
+  s->state = VT_GROUND;
+  return resize_vt_screen(s, rows, cols);
+}
+
+void free_vt_screen(struct VtScreen *s) {
+  free(s->cells);
+  s->cells = NULL;
+}
+
+bool resize_vt_screen(struct VtScreen *s, unsigned int rows,
+                      unsigned int cols) {
+  struct VtCell *cells = malloc((size_t)rows * cols * sizeof(struct VtCell));
+  if (!cells) {
+    return false;
+  }
+  struct VtCell blank = vt_blank(s);
+  for (unsigned int y = 0; y < rows; y++) {
+    for (unsigned int x = 0; x < cols; x++) {
+      bool kept = y < s->rows && x < s->cols;
+      cells[y * cols + x] = kept ? *vt_screen_cell(s, x, y) : blank;
+    }
+  }
+  free(s->cells);
+  s->cells = cells;
+  s->rows = rows;
+  s->cols = cols;
+  s->x = clamp(s->x, 0, cols - 1);
+  s->y = clamp(s->y, 0, rows - 1);
+  s->wrap_pending = false;
+  s->top = 0;
+  s->bottom = rows - 1;
+  return true;
+}
+
+////////////
+// Cursor //
+////////////
+
+void vt_move(struct VtScreen *s, unsigned int x, unsigned int y) {
+  s->x = clamp(x, 0, s->cols - 1);
+  s->y = clamp(y, 0, s->rows - 1);
+  s->wrap_pending = false;
+}
+
+void vt_line_feed(struct VtScreen *s) {
+  s->wrap_pending = false;
+  if (s->y == s->bottom) {
+    vt_scroll(s, s->top, s->bottom, -1);
+  } else if (s->y + 1 < s->rows) {
+    s->y++;
+  }
+}
+
+void vt_reverse_index(struct VtScreen *s) {
+  s->wrap_pending = false;
+  if (s->y == s->top) {
+    vt_scroll(s, s->top, s->bottom, 1);
+  } else if (s->y > 0) {
+    s->y--;
+  }
+}
+
+// Relative moves stop at the scroll region when they start inside of it.
+void vt_move_vertically(struct VtScreen *s, int rows) {
+  bool inside = s->y >= s->top && s->y <= s->bottom;
+  int low = inside ? (int)s->top : 0;
+  int high = inside ? (int)s->bottom : (int)s->rows - 1;
+  int y = (int)s->y + rows;
+  vt_move(s, s->x, y < low ? low : y > high ? high : y);
+}
+
+void vt_put(struct VtScreen *s, uint32_t codepoint) {
+  if (s->wrap_pending) {
+    s->x = 0;
+    vt_line_feed(s);
+  }
+  struct VtCell *c = vt_screen_cell(s, s->x, s->y);
+  c->codepoint = codepoint;
+  c->style = s->style;
+  s->last_codepoint = codepoint;
+  if (s->x + 1 == s->cols) {
+    s->wrap_pending = true;
+  } else {
+    s->x++;
+  }
+}
+
+/////////
+// SGR //
+/////////
+
+// Reads an extended color of SGR 38 or 48 starting at parameter i, in the
+// colon form when sub_parameters say so and the semicolon form otherwise.
+// Returns the number of parameters read, 0 when they are malformed.
+unsigned int vt_extended_color(struct VtScreen *s, unsigned int i,
+                               struct Color *color) {
+  unsigned int *p = s->parameters;
+  unsigned int available = s->parameter_count - i;
+  bool colon = available > 0 && s->sub_parameters[i];
+  if (colon) {
+    available = 0;
+    while (i + available < s->parameter_count &&
+           s->sub_parameters[i + available]) {
+      available++;
+    }
+  }
+
+  if (available >= 2 && p[i] == 5) {
+    *color = color_256(p[i + 1]);
+    return colon ? available : 2;
+  }
+  if (available >= 4 && p[i] == 2) {
+    // the colon form may carry a color space id before red, green and blue
+    unsigned int first = colon && available == 5 ? i + 2 : i + 1;
+    *color = color_rgb(p[first], p[first + 1], p[first + 2]);
+    return colon ? available : 4;
+  }
+  return 0;
+}
+
+void vt_sgr(struct VtScreen *s) {
+  struct Style *style = &s->style;
+  for (unsigned int i = 0; i < s->parameter_count; i++) {
+    unsigned int p = s->parameters[i];
+    if (p == 38 || p == 48) {
+      struct Color color;
+      unsigned int read = vt_extended_color(s, i + 1, &color);
+      if (read == 0) {
+        vt_error(s, "malformed SGR %u", p);
+        return;
+      }
+      *(p == 38 ? &style->color : &style->background) = color;
+      i += read;
+    } else if (p == 0) {
+      *style = default_style();
+    } else if (vt_mode(p)) {
+      style->modes |= MODE_BIT(p);
+    } else if (p == 22) {
+      style->modes &= ~(MODE_BIT(BOLD) | MODE_BIT(DIM));
+    } else if (p > 22 && vt_mode(p - 20)) {
+      style->modes &= ~MODE_BIT(p - 20);
+    } else if (p >= 30 && p <= 37) {
+      style->color = color_8(p - 30);
+    } else if (p == 39) {
+      style->color = default_color();
+    } else if (p >= 40 && p <= 47) {
+      style->background = color_8(p - 40);
+    } else if (p == 49) {
+      style->background = default_color();
+    } else {
+      vt_error(s, "unsupported SGR %u", p);
+      return;
+    }
+  }
+}
+
+///////////////////
+// Control Codes //
+///////////////////
+
+// a parameter of 0 or a missing one means 1
+unsigned int vt_count(struct VtScreen *s, unsigned int i) {
+  unsigned int p = i < s->parameter_count ? s->parameters[i] : 0;
+  return p == 0 ? 1 : p;
+}
+
+void vt_erase_display(struct VtScreen *s, unsigned int mode) {
+  switch (mode) {
+  case 0:
+    vt_erase(s, s->y, s->x, s->cols);
+    for (unsigned int y = s->y + 1; y < s->rows; y++) {
+      vt_erase(s, y, 0, s->cols);
+    }
+    break;
+  case 1:
+    for (unsigned int y = 0; y < s->y; y++) {
+      vt_erase(s, y, 0, s->cols);
+    }
+    vt_erase(s, s->y, 0, s->x + 1);
+    break;
+  case 2:
+  case 3:
+    for (unsigned int y = 0; y < s->rows; y++) {
+      vt_erase(s, y, 0, s->cols);
+    }
+    break;
+  default:
+    vt_error(s, "unsupported ED %u", mode);
+  }
+}
+
+void vt_erase_line(struct VtScreen *s, unsigned int mode) {
+  switch (mode) {
+  case 0:
+    vt_erase(s, s->y, s->x, s->cols);
+    break;
+  case 1:
+    vt_erase(s, s->y, 0, s->x + 1);
+    break;
+  case 2:
+    vt_erase(s, s->y, 0, s->cols);
+    break;
+  default:
+    vt_error(s, "unsupported EL %u", mode);
+  }
+}
+
+void vt_set_scroll_region(struct VtScreen *s) {
+  unsigned int top = vt_count(s, 0) - 1;
+  unsigned int bottom = s->parameter_count > 1 && s->parameters[1] != 0
+                            ? s->parameters[1] - 1
+                            : s->rows - 1;
+  if (top < bottom && bottom < s->rows) {
+    s->top = top;
+    s->bottom = bottom;
+  }
+  vt_move(s, 0, 0);
+}
+
+// Lines are inserted and deleted inside the scroll region only.
+void vt_shift_lines(struct VtScreen *s, int offset) {
+  if (s->y < s->top || s->y > s->bottom) {
+    return;
+  }
+  vt_scroll(s, s->y, s->bottom, offset);
+  s->x = 0;
+  s->wrap_pending = false;
+}
+
+void vt_csi(struct VtScreen *s, char final) {
+  if (s->private_marker) {
+    // DEC private modes and the like do not change the grid
+    if (s->private_marker != '?' || (final != 'h' && final != 'l')) {
+      vt_error(s, "unsupported CSI %c %c", s->private_marker, final);
+    }
+    return;
+  }
+
+  unsigned int n = vt_count(s, 0);
+  switch (final) {
+  case 'A':
+    vt_move_vertically(s, -(int)n);
+    break;
+  case 'B':
+    vt_move_vertically(s, n);
+    break;
+  case 'C':
+    vt_move(s, s->x + n, s->y);
+    break;
+  case 'D':
+    vt_move(s, n > s->x ? 0 : s->x - n, s->y);
+    break;
+  case 'G':
+    vt_move(s, n - 1, s->y);
+    break;
+  case 'd':
+    vt_move(s, s->x, n - 1);
+    break;
+  case 'H':
+  case 'f':
+    vt_move(s, vt_count(s, 1) - 1, n - 1);
+    break;
+  case 'J':
+    vt_erase_display(s, s->parameters[0]);
+    break;
+  case 'K':
+    vt_erase_line(s, s->parameters[0]);
+    break;
+  case 'X':
+    vt_erase(s, s->y, s->x, s->x + n);
+    break;
+  case 'b':
+    for (unsigned int i = 0; i < n; i++) {
+      vt_put(s, s->last_codepoint);
+    }
+    break;
+  case 'r':
+    vt_set_scroll_region(s);
+    break;
+  case 'S':
+    vt_scroll(s, s->top, s->bottom, -(int)n);
+    break;
+  case 'T':
+    vt_scroll(s, s->top, s->bottom, n);
+    break;
+  case 'L':
+    vt_shift_lines(s, n);
+    break;
+  case 'M':
+    vt_shift_lines(s, -(int)n);
+    break;
+  case 'm':
+    vt_sgr(s);
+    break;
+  case 't':
+    // window operations
+    break;
+  default:
+    vt_error(s, "unsupported CSI %c", final);
+  }
+}
+
+void vt_escape(struct VtScreen *s, char c) {
+  s->state = VT_GROUND;
+  switch (c) {
+  case '[':
+    s->state = VT_CSI;
+    s->parameter_count = 1;
+    s->parameters[0] = 0;
+    s->sub_parameters[0] = false;
+    s->private_marker = 0;
+    break;
+  case 'D':
+    vt_line_feed(s);
+    break;
+  case 'E':
+    s->x = 0;
+    vt_line_feed(s);
+    break;
+  case 'M':
+    vt_reverse_index(s);
+    break;
+  default:
+    vt_error(s, "unsupported ESC %c", c);
+  }
+}
+
+void vt_csi_byte(struct VtScreen *s, char c) {
+  if (c >= '0' && c <= '9') {
+    unsigned int *p = &s->parameters[s->parameter_count - 1];
+    *p = *p * 10 + (c - '0');
+  } else if (c == ';' || c == ':') {
+    if (s->parameter_count == VT_MAX_PARAMETERS) {
+      vt_error(s, "too many parameters");
+      s->state = VT_GROUND;
+      return;
+    }
+    s->parameters[s->parameter_count] = 0;
+    s->sub_parameters[s->parameter_count] = c == ':';
+    s->parameter_count++;
+  } else if (c >= '<' && c <= '?') {
+    s->private_marker = c;
+  } else if (c >= 0x40 && c <= 0x7e) {
+    s->state = VT_GROUND;
+    vt_csi(s, c);
+  } else {
+    vt_error(s, "unsupported byte 0x%02x in CSI", (unsigned char)c);
+    s->state = VT_GROUND;
+  }
+}
+
+void vt_control(struct VtScreen *s, char c) {
+  switch (c) {
+  case '\033':
+    s->state = VT_ESCAPE;
+    break;
+  case '\r':
+    s->x = 0;
+    s->wrap_pending = false;
+    break;
+  case '\n':
+  case '\v':
+  case '\f':
+    vt_line_feed(s);
+    break;
+  case '\b':
+    vt_move(s, s->x > 0 ? s->x - 1 : 0, s->y);
+    break;
+  default:
+    vt_error(s, "unsupported control 0x%02x", (unsigned char)c);
+  }
+}
+
+void vt_utf8_byte(struct VtScreen *s, unsigned char c) {
+  if (s->utf8_remaining > 0) {
+    if ((c & 0xC0) != 0x80) {
+      vt_error(s, "invalid UTF-8");
+      s->utf8_remaining = 0;
+      return;
+    }
+    s->utf8_codepoint = s->utf8_codepoint << 6 | (c & 0x3F);
+    if (--s->utf8_remaining == 0) {
+      vt_put(s, s->utf8_codepoint);
+    }
+  } else if ((c & 0xE0) == 0xC0) {
+    s->utf8_codepoint = c & 0x1F;
+    s->utf8_remaining = 1;
+  } else if ((c & 0xF0) == 0xE0) {
+    s->utf8_codepoint = c & 0x0F;
+    s->utf8_remaining = 2;
+  } else if ((c & 0xF8) == 0xF0) {
+    s->utf8_codepoint = c & 0x07;
+    s->utf8_remaining = 3;
+  } else {
+    vt_error(s, "invalid UTF-8");
+  }
+}
+
+void feed_vt_screen(struct VtScreen *s, const char *bytes, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    char c = bytes[i];
+    switch (s->state) {
+    case VT_ESCAPE:
+      vt_escape(s, c);
+      break;
+    case VT_CSI:
+      vt_csi_byte(s, c);
+      break;
+    case VT_GROUND:
+      if ((unsigned char)c >= 0x80 || s->utf8_remaining > 0) {
+        vt_utf8_byte(s, c);
+      } else if (c < 0x20 || c == 0x7f) {
+        vt_control(s, c);
+      } else {
+        vt_put(s, c);
+      }
+      break;
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef vt_screen_h
+#define vt_screen_h
+#include "../lib/terminalio.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A small model of a VT/ANSI terminal screen: the cell grid, the cursor with
+// xterm's pending wrap, the scroll region and the SGR state. It understands
+// the sequences terminalio emits, anything else is recorded as an error
+// instead of being guessed at.
+
+#define VT_MAX_PARAMETERS 32
+#define VT_ERROR_SIZE 128
+
+struct VtCell {
+  uint32_t codepoint;
+  struct Style style;
+};
+
+enum VtState { VT_GROUND, VT_ESCAPE, VT_CSI };
+
+struct VtScreen {
+  unsigned int rows, cols;
+  struct VtCell *cells;
+  unsigned int x, y;
+  // the last column was written, the next character goes to the next line
+  bool wrap_pending;
+  // rows [top, bottom] scroll
+  unsigned int top, bottom;
+  struct Style style;
+  uint32_t last_codepoint;
+
+  // a sequence or UTF-8 character may be split across feeds
+  enum VtState state;
+  unsigned int parameters[VT_MAX_PARAMETERS];
+  // the parameter is a sub parameter of the one before, separated by ':'
+  bool sub_parameters[VT_MAX_PARAMETERS];
+  unsigned int parameter_count;
+  bool parameter_started;
+  char private_marker;
+  uint32_t utf8_codepoint;
+  unsigned int utf8_remaining;
+
+  // the first sequence the model does not understand, empty if there is none
+  char error[VT_ERROR_SIZE];
+};
+
+bool init_vt_screen(struct VtScreen *s, unsigned int rows, unsigned int cols);
+void free_vt_screen(struct VtScreen *s);
+// Keeps what fits like xterm does, the scroll region is reset.
+bool resize_vt_screen(struct VtScreen *s, unsigned int rows,
+                      unsigned int cols);
+void feed_vt_screen(struct VtScreen *s, const char *bytes, size_t length);
+struct VtCell *vt_screen_cell(struct VtScreen *s, unsigned int x,
+                              unsigned int y);
+
+#endif